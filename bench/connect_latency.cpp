@@ -0,0 +1,104 @@
+/**
+ * new-connection latency: connect, send one small request, wait for the echo, close
+ * compares a plain listener with TCP_DEFER_ACCEPT and TCP_FASTOPEN ( TcpServer::set_defer_accept
+ * / set_fast_open ), server and client in one process over loopback
+ * fastopen needs the client bit of net.ipv4.tcp_fastopen ( default 1 ), the first
+ * connection fetches the cookie and pays the full handshake
+ */
+// build from the repo root:
+//   g++ -O2 -std=c++17 -Isrc -Isrc/utils -Isrc/logger -Isrc/net/include -Isrc/threadpool -Isrc/buffer
+//       bench/connect_latency.cpp src/net/src/*.cpp -lpthread -o connect_latency
+// run:
+//   ./connect_latency plain|defer|fastopen [connections=5000]
+#include "tcpserver.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+namespace {
+
+constexpr int kPort = 19500;
+
+int64_t nowNanos() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// one request on a fresh connection, -1 on failure
+int64_t oneRequest(const sockaddr_in &addr, bool fastOpen) {
+    static const char kRequest[] = "ping";
+    char reply[16];
+    int64_t start = nowNanos();
+    int fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+    ssize_t sent;
+    if (fastOpen) {
+        // connect and send in one call, the data rides in the SYN once we hold a cookie
+        sent = ::sendto(fd, kRequest, sizeof(kRequest) - 1, MSG_FASTOPEN,
+                        reinterpret_cast<const sockaddr*>(&addr), sizeof(addr));
+    } else {
+        if (::connect(fd, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) != 0) {
+            ::close(fd);
+            return -1;
+        }
+        sent = ::send(fd, kRequest, sizeof(kRequest) - 1, 0);
+    }
+    ssize_t got = sent > 0 ? ::recv(fd, reply, sizeof(reply), 0) : -1;
+    ::close(fd);
+    return got > 0 ? nowNanos() - start : -1;
+}
+
+}
+
+int main(int argc, char **argv) {
+    std::string mode = argc > 1 ? argv[1] : "plain";
+    int connections = argc > 2 ? std::atoi(argv[2]) : 5000;
+    Logger::instance().setLevel(LogLevel::ERROR);
+
+    TcpServer server("127.0.0.1", kPort, 1);
+    if (mode == "defer" && !server.set_defer_accept(5)) std::fprintf(stderr, "TCP_DEFER_ACCEPT not available\n");
+    if (mode == "fastopen" && !server.set_fast_open(1024)) std::fprintf(stderr, "TCP_FASTOPEN not available\n");
+    server.set_message_callback([](const TcpConnectionPtr &conn, Buffer *buf, TimeStamp) {
+        conn->send(buf->readPtr(), buf->readableBytes());
+        buf->retrieveAll();
+    });
+    std::thread serverThread([&server] { server.start(); });
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(kPort);
+    ::inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+
+    bool fastOpen = mode == "fastopen";
+    oneRequest(addr, fastOpen);     // warm up, fetches the TFO cookie
+    std::vector<int64_t> samples;
+    samples.reserve(static_cast<size_t>(connections));
+    int failed = 0;
+    for (int i = 0; i < connections; ++i) {
+        int64_t ns = oneRequest(addr, fastOpen);
+        if (ns < 0) ++failed;
+        else samples.push_back(ns);
+    }
+
+    std::sort(samples.begin(), samples.end());
+    auto pct = [&samples](double p) {
+        return samples.empty() ? 0.0 : samples[static_cast<size_t>(p * (samples.size() - 1))] / 1e3;
+    };
+    double sum = 0;
+    for (int64_t s : samples) sum += static_cast<double>(s);
+    std::printf("%-8s connections %zu failed %d  avg %.1fus  p50 %.1fus  p99 %.1fus\n",
+                mode.c_str(), samples.size(), failed,
+                samples.empty() ? 0.0 : sum / samples.size() / 1e3, pct(0.5), pct(0.99));
+    std::fflush(stdout);
+    ::_exit(0);     // the server runs until the process ends
+}
@@ -0,0 +1,124 @@
+/**
+ * small-request latency next to bulk senders on the same io loop
+ * bulk clients stream data through an echo server as fast as it goes, one client
+ * does ping-pong with 32 byte messages; reports the ping p50/p99 and bulk throughput
+ * for a given per-connection read batch ( TcpServer::set_read_batch )
+ */
+// build from the repo root:
+//   g++ -O2 -std=c++17 -Isrc -Isrc/utils -Isrc/logger -Isrc/net/include -Isrc/threadpool -Isrc/buffer
+//       bench/read_fairness.cpp src/net/src/*.cpp -lpthread -o read_fairness
+// run:
+//   ./read_fairness [batch_bytes=0] [batch_reads=1] [bulk_clients=2] [seconds=3]
+//   batch_bytes 0 keeps the default, one read per event
+#include "tcpserver.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+namespace {
+
+constexpr int kPort = 19501;
+
+int64_t nowNanos() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+int connectTo(const sockaddr_in &addr) {
+    int fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || ::connect(fd, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) != 0) {
+        std::perror("connect");
+        std::exit(1);
+    }
+    return fd;
+}
+
+}
+
+int main(int argc, char **argv) {
+    size_t batchBytes = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 0;
+    int batchReads = argc > 2 ? std::atoi(argv[2]) : 1;
+    int bulkClients = argc > 3 ? std::atoi(argv[3]) : 2;
+    double seconds = argc > 4 ? std::atof(argv[4]) : 3.0;
+    Logger::instance().setLevel(LogLevel::ERROR);
+
+    TcpServer server("127.0.0.1", kPort, 1);     // one io loop, everybody shares it
+    if (batchBytes) server.set_read_batch(batchBytes, batchReads);
+    server.set_message_callback([](const TcpConnectionPtr &conn, Buffer *buf, TimeStamp) {
+        conn->send(buf->readPtr(), buf->readableBytes());
+        buf->retrieveAll();
+    });
+    std::thread serverThread([&server] { server.start(); });
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(kPort);
+    ::inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+
+    std::atomic<bool> stop{false};
+    std::atomic<uint64_t> bulkBytes{0};
+    std::vector<std::thread> threads;
+    for (int i = 0; i < bulkClients; ++i) {
+        int fd = connectTo(addr);
+        // writer and reader per bulk connection, the echo flows back as fast as it is read
+        threads.emplace_back([fd, &stop] {
+            std::vector<char> chunk(256 * 1024, 'x');
+            while (!stop.load(std::memory_order_relaxed)) {
+                if (::send(fd, chunk.data(), chunk.size(), MSG_NOSIGNAL) <= 0) break;
+            }
+            ::shutdown(fd, SHUT_WR);
+        });
+        threads.emplace_back([fd, &stop, &bulkBytes] {
+            std::vector<char> sink(1 << 20);
+            ssize_t n;
+            while ((n = ::recv(fd, sink.data(), sink.size(), 0)) > 0) {
+                if (!stop.load(std::memory_order_relaxed)) bulkBytes.fetch_add(static_cast<uint64_t>(n), std::memory_order_relaxed);
+            }
+        });
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));    // let the bulk flows ramp up
+
+    int fd = connectTo(addr);
+    int one = 1;
+    ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    char ping[32] = {}, pong[64];
+    std::vector<int64_t> samples;
+    uint64_t bulkStart = bulkBytes.load();
+    int64_t start = nowNanos();
+    int64_t end = start + static_cast<int64_t>(seconds * 1e9);
+    while (nowNanos() < end) {
+        int64_t t = nowNanos();
+        if (::send(fd, ping, sizeof(ping), 0) != sizeof(ping)) break;
+        size_t got = 0;
+        while (got < sizeof(ping)) {
+            ssize_t n = ::recv(fd, pong, sizeof(pong), 0);
+            if (n <= 0) break;
+            got += static_cast<size_t>(n);
+        }
+        samples.push_back(nowNanos() - t);
+    }
+    double elapsed = (nowNanos() - start) / 1e9;
+    uint64_t moved = bulkBytes.load() - bulkStart;
+    stop = true;
+
+    std::sort(samples.begin(), samples.end());
+    auto pct = [&samples](double p) {
+        return samples.empty() ? 0.0 : samples[static_cast<size_t>(p * (samples.size() - 1))] / 1e3;
+    };
+    std::printf("batch %zu x %d, %d bulk: pings %zu  p50 %.0fus  p99 %.0fus  p999 %.0fus  bulk %.0f MB/s\n",
+                batchBytes, batchReads, bulkClients, samples.size(), pct(0.5), pct(0.99), pct(0.999),
+                moved / elapsed / 1e6);
+    std::fflush(stdout);
+    ::_exit(0);     // the server and the bulk threads run until the process ends
+}
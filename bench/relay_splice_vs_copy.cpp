@@ -0,0 +1,132 @@
+/**
+ * relay cost: the splice Relay against a copy relay built on the message callback
+ * a child process runs the relay on one io loop and pairs the first two connections it
+ * accepts ( sink, then source ); the parent streams bytes source -> relay -> sink and
+ * reports throughput, and CPU seconds per GB of the relay process ( from wait4 )
+ */
+// build from the repo root:
+//   g++ -O2 -std=c++17 -Isrc -Isrc/utils -Isrc/logger -Isrc/net/include -Isrc/threadpool -Isrc/buffer
+//       bench/relay_splice_vs_copy.cpp src/net/src/*.cpp -lpthread -o relay_splice_vs_copy
+// run:
+//   ./relay_splice_vs_copy splice|copy [megabytes=2048]
+#include "tcpserver.h"
+#include "relay.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+#include <csignal>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+namespace {
+
+constexpr int kPort = 19502;
+
+int64_t nowNanos() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+int connectTo(const sockaddr_in &addr) {
+    int fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || ::connect(fd, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) != 0) {
+        std::perror("connect");
+        std::exit(1);
+    }
+    return fd;
+}
+
+[[noreturn]] void runRelay(bool splice) {
+    Logger::instance().setLevel(LogLevel::ERROR);
+    TcpServer server("127.0.0.1", kPort, 1);    // one io loop, both ends live on it
+    TcpConnectionPtr waiting;
+    server.set_connection_callback([&waiting, splice](const TcpConnectionPtr &conn) {
+        if (!conn->connected()) return;
+        if (!waiting) {
+            waiting = conn;
+            return;
+        }
+        if (splice) {
+            if (!Relay::start(waiting, conn)) std::fprintf(stderr, "Relay::start failed\n");
+        } else {
+            waiting->setContext(conn->handle());
+            conn->setContext(waiting->handle());
+        }
+        waiting.reset();
+    });
+    // the copy relay: read into the input buffer, send() copies into the peer ( or its buffer )
+    server.set_message_callback([](const TcpConnectionPtr &conn, Buffer *buf, TimeStamp) {
+        auto *peer = std::any_cast<TcpConnection::Handle>(conn->getMutableContext());
+        TcpConnectionPtr to = peer ? peer->lock() : TcpConnectionPtr();
+        if (to) to->send(buf->readPtr(), buf->readableBytes());
+        buf->retrieveAll();
+    });
+    server.start();
+    ::_exit(0);
+}
+
+}
+
+int main(int argc, char **argv) {
+    std::string mode = argc > 1 ? argv[1] : "splice";
+    size_t total = (argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 2048) << 20;
+    if (mode != "splice" && mode != "copy") {
+        std::fprintf(stderr, "usage: %s splice|copy [megabytes]\n", argv[0]);
+        return 1;
+    }
+
+    pid_t child = ::fork();
+    if (child == 0) runRelay(mode == "splice");
+    std::this_thread::sleep_for(std::chrono::milliseconds(300));
+
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(kPort);
+    ::inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+    int sink = connectTo(addr);
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));     // accepted first
+    int source = connectTo(addr);
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+    int64_t start = nowNanos();
+    std::thread writer([source, total] {
+        std::vector<char> chunk(256 * 1024, 'x');
+        size_t sent = 0;
+        while (sent < total) {
+            ssize_t n = ::send(source, chunk.data(), std::min(chunk.size(), total - sent), MSG_NOSIGNAL);
+            if (n <= 0) break;
+            sent += static_cast<size_t>(n);
+        }
+    });
+    std::vector<char> buf(1 << 20);
+    size_t received = 0;
+    while (received < total) {
+        ssize_t n = ::recv(sink, buf.data(), buf.size(), 0);
+        if (n <= 0) break;
+        received += static_cast<size_t>(n);
+    }
+    double elapsed = (nowNanos() - start) / 1e9;
+    writer.join();
+
+    ::kill(child, SIGKILL);
+    int status = 0;
+    rusage usage{};
+    ::wait4(child, &status, 0, &usage);
+    double cpu = usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 +
+                 usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+    double gb = received / 1e9;
+    std::printf("%-6s relayed %zu MB in %.2fs  %.0f MB/s  relay cpu %.2fs ( user %.2f sys %.2f )  %.2f cpu-s/GB\n",
+                mode.c_str(), received >> 20, elapsed, received / elapsed / 1e6, cpu,
+                usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6,
+                usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6, gb > 0 ? cpu / gb : 0.0);
+    return received == total ? 0 : 1;
+}
@@ -1,25 +1,60 @@
 #pragma once
 
 #include "noncopyable.h"
+#include "simd_search.h"
+#include "clock.h"
+#include "slabArena.h"
 
 #include <memory>
 #include <unistd.h>
 #include <sys/types.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
 #include <cstring>
 #include <array>
 #include <mutex>
 #include <cstdlib>
+#include <cstdint>
 #include <algorithm>
 #include <stack>
 #include <vector>
 #include <cerrno>
 #include <stdexcept>
+#include <atomic>
+#include <iterator>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
 
 namespace buffer_internal {
+    // storage is deleted unless it has a release: borrowed storage ( a slab slot, inline
+    // bytes ) releases nothing, leased storage goes back to whoever lent it
+    struct StorageDeleter {
+        void (*release)(void *lease) = nullptr;
+        void *lease = nullptr;
+        void operator()(char *p) const { if (release) release(lease); else delete[] p; }
+    };
+    inline void keepBorrowed(void*) {}
+    using Storage = std::unique_ptr<char[], StorageDeleter>;
+    // storage of at least capacity bytes, capacity is set to what it got
+    using SpillFn = Storage (*)(size_t &capacity);
+
     class Buffer {
     public:
+        // size 0: no storage until the first write ( idle connections hold nothing )
         explicit Buffer(size_t size = 4096)
-            : data_(new char[size]), capacity_(size), read_pos_(0), write_pos_(0) {}
+            : data_(size ? new char[size] : nullptr), capacity_(size), read_pos_(0), write_pos_(0) {}
+
+        // over memory owned by someone else ( a slab slot, inline bytes ), growing moves
+        // the data to the heap and shrink() brings it back home
+        Buffer(char *storage, size_t size)
+            : data_(storage, StorageDeleter{&keepBorrowed}), capacity_(size), read_pos_(0), write_pos_(0),
+              home_(storage), home_capacity_(size) {}
+        bool ownsStorage() const { return data_.get_deleter().release != &keepBorrowed; }
+        // bytes held beyond home storage ( heap or leased ), 0 while at home
+        size_t heapBytes() const { return ownsStorage() ? capacity_ : 0; }
+        // where growth takes its storage from, the heap when unset, e.g. BufferMemoryPool::spill
+        void setSpill(SpillFn spill) { spill_ = spill; }
     
         ~Buffer() = default;
     
@@ -30,8 +65,26 @@ namespace buffer_internal {
     
     
         // read data from socket fd -> this buffer 
-        // buffer writer
-        ssize_t readFromFD(int fd) {
+        // buffer writer, at most maxBytes ( rate limited connections )
+        ssize_t readFromFD(int fd, size_t maxBytes = SIZE_MAX) {
+            size_t room = std::min(writableBytes(), maxBytes);
+            if (writableBytes() < kMinGrowth && room < maxBytes) {
+                // small ( inline, released ) or full buffer: the overflow lands on the stack
+                // and is appended, so a small message allocates nothing and only data
+                // that really does not fit grows the buffer, still in one syscall
+                char extra[kStackReadBytes];
+                iovec iov[2] = { { data_.get() + write_pos_, room },
+                                 { extra, std::min(sizeof(extra), maxBytes - room) } };
+                ssize_t n;
+                do {
+                    n = ::readv(fd, room ? iov : iov + 1, room ? 2 : 1);
+                } while (n < 0 && errno == EINTR);
+                if (n <= 0) return n;
+                size_t got = static_cast<size_t>(n);
+                write_pos_ += std::min(got, room);
+                if (got > room) append(extra, got - room);
+                return n;
+            }
             if (writableBytes() == 0) {
                 // 尝试压缩或扩容以获得写空间
                 ensureWritableBytes(1);
@@ -40,7 +93,7 @@ namespace buffer_internal {
     
             ssize_t n;
             for (;;) {
-                n = ::read(fd, data_.get() + write_pos_, static_cast<size_t>(writableBytes()));
+                n = ::read(fd, data_.get() + write_pos_, std::min(writableBytes(), maxBytes));
                 if (n < 0) {
                     if (errno == EINTR) continue; // 中断重试
                     // 非阻塞且没有数据可读时返回 -1（errno 保持原样供上层判断）
@@ -54,13 +107,18 @@ namespace buffer_internal {
         }
     
         // 将缓冲区的数据写入 socket（支持 EINTR 重试）
-        ssize_t writeToFD(int fd) {
+        // sockets get MSG_NOSIGNAL ( EPIPE, not SIGPIPE ), anything else a plain write
+        ssize_t writeToFD(int fd, size_t maxBytes = SIZE_MAX) {
             if (readableBytes() == 0) return 0;
             ssize_t n;
+            bool socket = true;
             for (;;) {
-                n = ::write(fd, data_.get() + read_pos_, static_cast<size_t>(readableBytes()));
+                size_t len = std::min(readableBytes(), maxBytes);
+                n = socket ? ::send(fd, data_.get() + read_pos_, len, MSG_NOSIGNAL)
+                           : ::write(fd, data_.get() + read_pos_, len);
                 if (n < 0) {
                     if (errno == EINTR) continue;
+                    if (errno == ENOTSOCK && socket) { socket = false; continue; }
                     return -1;
                 }
                 break;
@@ -114,7 +172,44 @@ namespace buffer_internal {
             write_pos_ += len;
         }
     
-    private:
+        // vectorized search over the readable bytes, nullptr when absent
+        // cursor ( optional ): offset from readPtr() to start at; on a miss it is moved
+        // to where the next call should resume, so a line growing over several reads
+        // is never rescanned. reset it to 0 after retrieving the match
+        const char* findCRLF(size_t *cursor = nullptr) const {
+            return search(cursor, 1, [](const char *b, const char *e) { return simd::findCRLF(b, e); });
+        }
+        const char* findByte(char c, size_t *cursor = nullptr) const {
+            return search(cursor, 0, [c](const char *b, const char *e) { return simd::findByte(b, e, c); });
+        }
+        // set holds up to 16 bytes
+        const char* findAnyOf(const char *set, size_t n, size_t *cursor = nullptr) const {
+            return search(cursor, 0, [set, n](const char *b, const char *e) { return simd::findAnyOf(b, e, set, n); });
+        }
+
+        // write len bytes in front of the readable data, e.g. a length header
+        // uses the prependable space when there is enough, otherwise shifts once
+        void prepend(const void* data, size_t len) {
+            if (len > prependableBytes()) {
+                ensureWritableBytes(len);   // may compact, recompute the shift after
+                size_t shift = len - prependableBytes();
+                std::memmove(data_.get() + read_pos_ + shift, data_.get() + read_pos_, readableBytes());
+                read_pos_ += shift;
+                write_pos_ += shift;
+            }
+            read_pos_ -= len;
+            std::memcpy(data_.get() + read_pos_, data, len);
+        }
+
+        // on an empty buffer, leave len bytes in front for a later prepend()
+        void reservePrepend(size_t len) {
+            if (readableBytes() != 0) return;
+            retrieveAll();
+            ensureWritableBytes(len);
+            read_pos_ = len;
+            write_pos_ = len;
+        }
+
         // 1. Consolidation the fragments ( recycle the space )
         // 2. allocate more space, at least double it.
         void ensureWritableBytes(size_t len) {
@@ -129,9 +224,9 @@ namespace buffer_internal {
                 read_pos_ = 0;
                 write_pos_ = readable;
             } else {
-                // 扩容：扩大到 max(capacity*2, capacity + len)
-                size_t new_capacity = std::max(capacity_ * 2, capacity_ + len);
-                std::unique_ptr<char[]> new_data(new char[new_capacity]);
+                // 扩容：扩大到 max(capacity*2, capacity + len), a released buffer restarts at kMinGrowth
+                size_t new_capacity = std::max({capacity_ * 2, capacity_ + len, kMinGrowth});
+                Storage new_data = allocate(new_capacity);
                 if (readable > 0) {
                     std::memcpy(new_data.get(), data_.get() + read_pos_, readable);
                 }
@@ -142,72 +237,246 @@ namespace buffer_internal {
             }
         }
     
-        std::unique_ptr<char[]> data_;
+        // give memory back: storage drops to max(readable, keep) bytes, nothing at all
+        // for keep 0 on an empty buffer, and grows again on the next write
+        // returns whether anything was freed
+        bool shrink(size_t keep = 0) {
+            size_t readable = readableBytes();
+            size_t target = std::max(readable, keep);
+            if (home_ && target <= home_capacity_) {
+                if (data_.get() == home_) return false;
+                if (readable > 0) std::memcpy(home_, data_.get() + read_pos_, readable);
+                data_ = Storage(home_, StorageDeleter{&keepBorrowed});
+                capacity_ = home_capacity_;
+                read_pos_ = 0;
+                write_pos_ = readable;
+                return true;
+            }
+            if (capacity_ <= target) return false;
+            Storage new_data = target ? allocate(target) : Storage();
+            if (readable > 0) std::memcpy(new_data.get(), data_.get() + read_pos_, readable);
+            data_.swap(new_data);
+            capacity_ = target;
+            read_pos_ = 0;
+            write_pos_ = readable;
+            return true;
+        }
+
+        static constexpr size_t kMinGrowth = 1024;
+        static constexpr size_t kStackReadBytes = 4096;    // the old default buffer size, keeps per-read work the same
+
+    private:
+        Storage allocate(size_t &capacity) const {
+            return spill_ ? spill_(capacity) : Storage(new char[capacity]);
+        }
+
+        // overlap: bytes of a multi-byte pattern that may straddle the resume point
+        template<typename Finder>
+        const char* search(size_t *cursor, size_t overlap, Finder find) const {
+            const char *begin = readPtr();
+            const char *end = begin + readableBytes();
+            size_t from = cursor ? std::min(*cursor, readableBytes()) : 0;
+            const char *p = find(begin + from, end);
+            if (p == end) {
+                if (cursor) *cursor = readableBytes() > overlap ? readableBytes() - overlap : 0;
+                return nullptr;
+            }
+            if (cursor) *cursor = static_cast<size_t>(p - begin);
+            return p;
+        }
+
+        Storage data_;
         size_t capacity_;
         size_t read_pos_;
         size_t write_pos_;
+        char *home_ = nullptr;      // borrowed storage to fall back to, if any
+        size_t home_capacity_ = 0;
+        SpillFn spill_ = nullptr;
+    };
+
+    /**
+     * Buffer with its first N bytes inside the object: heartbeats, acks and other
+     * small messages never touch the allocator and sit in the owner's cache lines,
+     * anything bigger spills to the heap and shrink() returns it inline
+     * pinned in place, the base points into the object
+     */
+    template <size_t N>
+    class InlineBuffer : public Buffer {
+    public:
+        InlineBuffer() : Buffer(inline_, N) {}
+        InlineBuffer(const InlineBuffer&) = delete;
+        InlineBuffer& operator=(const InlineBuffer&) = delete;
+
+    private:
+        alignas(16) char inline_[N];
     };
 
 }
 
+/**
+ * where buffers live: by default each Buffer and its payload are separate heap
+ * allocations; with slab, a growth step carves all its buffers from one arena
+ * block, each slot a cache-line aligned [ Buffer | payload ], so a buffer and
+ * its bytes share a page and neighbours are contiguous
+ * slab memory stays reserved for the life of the pool, trim() skips it
+ */
+struct PoolBacking {
+    bool slab = false;
+    SlabArenaOptions arena;
+};
+
 class FixedSizePool : Noncopyable {
 using Buffer = buffer_internal::Buffer;
 public:
-    // manage shared_ptr<Buffer> with fixed capacity
-    FixedSizePool(size_t block_size, size_t prealloc_count = 100)
-        : block_size_(block_size) {
+    // counters since construction, free/live are the current sizes
+    struct Stats {
+        uint64_t allocs = 0;
+        uint64_t hits = 0;          // served from the free list
+        uint64_t misses = 0;        // had to create buffers
+        uint64_t frees = 0;
+        uint64_t discarded = 0;     // came back grown past block_size, deleted
+        uint64_t trimmed = 0;       // free buffers given back by trim()
+        size_t live = 0;
+        size_t free = 0;
+        size_t slab_bytes = 0;      // mapped by the arena, slab backing only
+    };
+
+    using Backing = PoolBacking;
+    static constexpr size_t kMaxExpand = 1000;
+
+    // manage Buffer objects with fixed capacity
+    // prealloc_count is also the floor trim() keeps, growth steps double from
+    // min_expand up to max_expand buffers
+    FixedSizePool(size_t block_size, size_t prealloc_count = 100,
+                  size_t min_expand = 10, size_t max_expand = kMaxExpand,
+                  const Backing &backing = Backing())
+        : block_size_(block_size), min_free_(prealloc_count),
+          min_expand_(std::max<size_t>(min_expand, 1)), max_expand_(std::max(max_expand, min_expand_)),
+          expand_size_(min_expand_),
+          arena_(backing.slab ? std::make_unique<SlabArena>(backing.arena) : nullptr) {
         preallocate(prealloc_count);
+        low_water_ = free_list_.size();
     }
 
+    // buffers still handed out when the pool dies are not tracked, and not freed
     ~FixedSizePool() = default;
 
-    // allocate returns a Buffer* from pool or creates a new one
+    // allocate returns a Buffer* from pool or creates a new one, the caller owns it until deallocate
     Buffer* allocate() {
         // lock for stack: free_list
         std::lock_guard<std::mutex> lock(mutex_);
+        ++stats_.allocs;
         if (free_list_.empty()) {
+            ++stats_.misses;
             // create new Buffer objects to expand
-            for (size_t i = 0; i < expand_size_; ++i) {
-                storage_.push_back(std::make_unique<Buffer>(block_size_));
-                free_list_.push( storage_.back().get() );
-            }
-            expand_size_ = std::min(expand_size_ * 2, MAX_EXPAND_SIZE);
+            preallocate(expand_size_);
+            expand_size_ = std::min(expand_size_ * 2, max_expand_);
+        } else {
+            ++stats_.hits;
         }
         if (free_list_.empty()) return nullptr;
-        auto buf = free_list_.top();
-        free_list_.pop();
+        Buffer *buf = free_list_.back().release();
+        if (arena_) __builtin_prefetch(buf->data(), 1);     // the payload sits right after
+        free_list_.pop_back();
+        ++stats_.live;
+        low_water_ = std::min(low_water_, free_list_.size());
         return buf;
     }
 
-    // return buffer to pool only if capacity matches
+    // back to the free list, a buffer that grew in use is deleted instead
+    // ( a slab buffer moves back into its own slot )
     void deallocate(Buffer* buf) {
         if (!buf) return;
-        if (buf->capacity() != block_size_) return; // ignore mismatched sizes
-        std::lock_guard<std::mutex> lock(mutex_);
         // reset buffer pointers before returning
         buf->retrieveAll();
-        free_list_.push(buf);
+        BufferPtr owned(buf, Dispose{ arena_ != nullptr });
+        bool grown = buf->capacity() != block_size_;
+        if (grown && arena_) buf->shrink();     // back into its own slot, the heap storage goes
+        std::lock_guard<std::mutex> lock(mutex_);
+        ++stats_.frees;
+        --stats_.live;
+        if (grown) {
+            ++stats_.discarded;
+            if (!arena_) return;
+        }
+        free_list_.push_back(std::move(owned));
+    }
+
+    // free the buffers nobody needed since the last trim ( the free list never went
+    // below them ), keeping at least the preallocated count, return how many went
+    size_t trim() {
+        if (arena_) return 0;
+        std::vector<BufferPtr> dropped;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            size_t spare = free_list_.size() > min_free_ ? free_list_.size() - min_free_ : 0;
+            size_t n = std::min(low_water_, spare);
+            // the bottom of the stack is the coldest
+            dropped.assign(std::make_move_iterator(free_list_.begin()),
+                           std::make_move_iterator(free_list_.begin() + n));
+            free_list_.erase(free_list_.begin(), free_list_.begin() + n);
+            stats_.trimmed += n;
+            low_water_ = free_list_.size();
+            if (n) expand_size_ = min_expand_;
+        }
+        return dropped.size();      // deleted outside the lock
     }
 
     size_t block_size() const { return block_size_; }
-    size_t free_block_count() const { return free_list_.size(); }
+    size_t free_block_count() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return free_list_.size();
+    }
+    Stats stats() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        Stats s = stats_;
+        s.free = free_list_.size();
+        s.slab_bytes = arena_ ? arena_->mappedBytes() : 0;
+        return s;
+    }
 
 private:
+    // slab buffers are destroyed in place, their memory belongs to the arena
+    struct Dispose {
+        bool slab = false;
+        void operator()(Buffer *buf) const {
+            if (slab) buf->~Buffer();
+            else delete buf;
+        }
+    };
+    using BufferPtr = std::unique_ptr<Buffer, Dispose>;
+
+    static constexpr size_t kHeaderStride = (sizeof(Buffer) + SlabArena::kCacheLine - 1) / SlabArena::kCacheLine * SlabArena::kCacheLine;
+
     void preallocate(size_t count) {
-        for (size_t i = 0; i < count; ++i) {
-            storage_.push_back(std::make_unique<Buffer>(block_size_));
-            free_list_.push(storage_.back().get());
+        if (!count) return;
+        if (!arena_) {
+            for (size_t i = 0; i < count; ++i) {
+                free_list_.push_back(BufferPtr(new Buffer(block_size_), Dispose{false}));
+            }
+            return;
+        }
+        size_t stride = kHeaderStride + (block_size_ + SlabArena::kCacheLine - 1) / SlabArena::kCacheLine * SlabArena::kCacheLine;
+        char *slots = static_cast<char*>(arena_->carve(stride * count));
+        // reverse, so the stack hands slots out in address order
+        for (size_t i = count; i > 0; --i) {
+            char *slot = slots + (i - 1) * stride;
+            free_list_.push_back(BufferPtr(new (slot) Buffer(slot + kHeaderStride, block_size_), Dispose{true}));
         }
     }
 
     size_t block_size_;
-    size_t expand_size_ = 10;
-    std::vector<std::unique_ptr<Buffer>> storage_;
-    // lightweight raw pointer
-    std::stack< Buffer* > free_list_;       
-    std::mutex mutex_;
+    size_t min_free_;
+    size_t min_expand_;
+    size_t max_expand_;
+    size_t expand_size_;
+    std::unique_ptr<SlabArena> arena_;      // slab backing, outlives the free list below
+    // used as a stack, back is the most recently returned ( cache-warm ) buffer
+    std::vector<BufferPtr> free_list_;
+    size_t low_water_;          // smallest free list size since the last trim
+    Stats stats_;
+    mutable std::mutex mutex_;
 
-    static constexpr size_t MAX_EXPAND_SIZE = 1000;
 };
 
 // singleton instance
@@ -252,6 +521,7 @@ public:
             return *this;
         }
         Buffer* get() const { return buf_; }
+        int bucket() const { return bucket_idx_; }
 
         Buffer* operator->() const { return buf_; }     // key!!!!
         explicit operator bool() const { return buf_ != nullptr; }
@@ -272,8 +542,17 @@ public:
     };
     friend class PooledBuffer;
 
+    struct ClassStats {
+        size_t block_size;
+        FixedSizePool::Stats stats;
+    };
+    // requested sizes by power of two: bucket b counts sizes in ( 2^(b-1), 2^b ]
+    static constexpr size_t kHistogramBuckets = 64;
+    using Histogram = std::array<uint64_t, kHistogramBuckets>;
+
     // Acquire a move-only PooledBuffer ( so dont need to care about competition )
     PooledBuffer acquire(size_t size) {
+        histogram_[histogramBucket(size)].fetch_add(1, std::memory_order_relaxed);
         for(int i = 0; i < pools_.size(); ++i){
             auto &pool = pools_[i];
             if(size <= pool->block_size()){
@@ -284,16 +563,112 @@ public:
                 return PooledBuffer(raw, this, i);
             }
         }
-        // for huge, allocate directly, delete on release
+        // beyond the largest pooled class, allocate directly, delete on release
+        oversize_.fetch_add(1, std::memory_order_relaxed);
         Buffer *raw = new Buffer(size);
         return PooledBuffer(raw, this, -1);
     }
 
+    /**
+     * replace the size classes, ascending, e.g. configure(suggestClasses(4))
+     * sizes above the last class still go through the power-of-two large classes
+     * only at startup: not safe against concurrent acquire or release
+     */
+    // backing applies to these classes, e.g. slab + hugepages + populate to pre-fault at startup
+    void configure(std::vector<size_t> classes, size_t prealloc = 0,
+                   const FixedSizePool::Backing &backing = FixedSizePool::Backing()) {
+        std::sort(classes.begin(), classes.end());
+        classes.erase(std::unique(classes.begin(), classes.end()), classes.end());
+        pools_.clear();
+        for (size_t size : classes) {
+            if (size) pools_.emplace_back(std::make_unique<FixedSizePool>(size, prealloc, 10, FixedSizePool::kMaxExpand, backing));
+        }
+        addLargeClasses(pools_.empty() ? 0 : pools_.back()->block_size());
+    }
+
+    // class boundaries fitting the sizes requested so far: the power of two at each
+    // of `count` evenly spaced quantiles, capped at kHugeSize ( larger ones use the large path )
+    std::vector<size_t> suggestClasses(size_t count) const {
+        Histogram h = histogram();
+        uint64_t total = 0;
+        for (uint64_t c : h) total += c;
+        std::vector<size_t> classes;
+        if (total == 0 || count == 0) return classes;
+        uint64_t seen = 0;
+        size_t next = 1;
+        for (size_t b = 0; b < kHistogramBuckets && next <= count; ++b) {
+            seen += h[b];
+            while (next <= count && seen * count >= next * total) {
+                size_t size = std::min(size_t(1) << b, kHugeSize);
+                if (classes.empty() || classes.back() != size) classes.push_back(size);
+                ++next;
+            }
+        }
+        return classes;
+    }
+
+    // give free buffers that sat unused since the last trim back to the system, returns how many went
+    // runs every trim interval from a timer calling trimIfDue(), never inline on acquire or
+    // release: freeing and malloc_trim can take milliseconds
+    // ( TcpServer and UdpServer run one on their main loop, other users call it now and then )
+    size_t trim() {
+        size_t freed = 0;
+        for (auto &pool : pools_) freed += pool->trim();
+#ifdef __GLIBC__
+        if (freed) ::malloc_trim(0);
+#endif
+        return freed;
+    }
+    // 0 disables the automatic trim
+    void setTrimInterval(double seconds) {
+        trim_interval_micros_.store(static_cast<int64_t>(seconds * 1e6), std::memory_order_relaxed);
+    }
+    // trim if an interval passed since the last one, cheap enough for a periodic timer
+    void trimIfDue() {
+        int64_t interval = trim_interval_micros_.load(std::memory_order_relaxed);
+        if (interval <= 0) return;
+        int64_t now = Clock::steadyMicros();
+        int64_t last = last_trim_micros_.load(std::memory_order_relaxed);
+        if (last == 0) {
+            last_trim_micros_.compare_exchange_strong(last, now, std::memory_order_relaxed);
+            return;
+        }
+        // one thread wins the trim
+        if (now - last >= interval && last_trim_micros_.compare_exchange_strong(last, now, std::memory_order_relaxed)) {
+            trim();
+        }
+    }
+
+    std::vector<ClassStats> stats() const {
+        std::vector<ClassStats> all;
+        for (auto &pool : pools_) all.push_back({ pool->block_size(), pool->stats() });
+        return all;
+    }
+    Histogram histogram() const {
+        Histogram h{};
+        for (size_t i = 0; i < kHistogramBuckets; ++i) h[i] = histogram_[i].load(std::memory_order_relaxed);
+        return h;
+    }
+    // acquires too large for any class
+    uint64_t oversize_count() const { return oversize_.load(std::memory_order_relaxed); }
+
+    // growth storage for buffers with home bytes ( Buffer::setSpill ): the payload of a
+    // pooled buffer, leased until the storage is dropped, so connection buffers grow and
+    // shrink through the size classes and count in stats() and trim()
+    static buffer_internal::Storage spill(size_t &capacity) {
+        PooledBuffer leased = instance().acquire(capacity);
+        if (!leased) return buffer_internal::Storage(new char[capacity]);
+        capacity = leased->capacity();
+        char *data = leased->data();
+        return buffer_internal::Storage(data, buffer_internal::StorageDeleter{&endLease, leased.detach()});
+    }
+
     // when manually releasing, you should do explicitly what destructor do implicitly
     void release(PooledBuffer &pooledBuffer) {
         if (!pooledBuffer) return;
+        int bucket = pooledBuffer.bucket();
         Buffer* buf = pooledBuffer.detach();
-        releaseRaw(buf, buf ? getBucketIndexForCapacity(buf->capacity()) : -1);
+        releaseRaw(buf, bucket);
     }
 
 
@@ -310,6 +685,29 @@ private:
         pools_.emplace_back(std::make_unique<FixedSizePool>(kMediumSize, 100));
         pools_.emplace_back(std::make_unique<FixedSizePool>(kLargeSize, 50));
         pools_.emplace_back(std::make_unique<FixedSizePool>(kHugeSize, 10));
+        addLargeClasses(kHugeSize);
+    }
+    // power-of-two classes above the configured ones, nothing preallocated and
+    // growing one buffer at a time, so big buffers get reused without being hoarded
+    void addLargeClasses(size_t above) {
+        for (size_t size = kHugeSize * 2; size <= kMaxPooledSize; size *= 2) {
+            if (size > above) pools_.emplace_back(std::make_unique<FixedSizePool>(size, 0, 1, 1));
+        }
+    }
+    // smallest b with 2^b >= size
+    static size_t histogramBucket(size_t size) {
+        if (size <= 1) return 0;
+        return std::min<size_t>(64 - __builtin_clzll(size - 1), kHistogramBuckets - 1);
+    }
+    // a lease never writes to the pooled buffer, its capacity still names the class
+    static void endLease(void *lease) {
+        Buffer *buf = static_cast<Buffer*>(lease);
+        BufferMemoryPool &pool = instance();
+        int bucket = -1;
+        for (int i = 0; i < static_cast<int>(pool.pools_.size()); ++i) {
+            if (pool.pools_[i]->block_size() == buf->capacity()) { bucket = i; break; }
+        }
+        pool.releaseRaw(buf, bucket);
     }
     void releaseRaw(Buffer *buffer, int bucket_idx){
         if(!buffer) return;
@@ -320,19 +718,17 @@ private:
         // unmanaged large buffer
         delete buffer;
     }
-    // helper: find bucket index by exact capacity (used by release)
-    int getBucketIndexForCapacity(size_t cap) const {
-        for (size_t i = 0; i < pools_.size(); ++i) {
-            if (pools_[i]->block_size() == cap) return static_cast<int>(i);
-        }
-        return -1;
-    }
     static constexpr size_t kSmallSize = 256;
     static constexpr size_t kMediumSize = 1024;
     static constexpr size_t kLargeSize = 8 * 1024;
     static constexpr size_t kHugeSize = 64 * 1024;
+    static constexpr size_t kMaxPooledSize = 16 * 1024 * 1024;
 
-    std::vector<std::unique_ptr<FixedSizePool>> pools_;
+    std::vector<std::unique_ptr<FixedSizePool>> pools_;     // ascending block sizes
+    std::array<std::atomic<uint64_t>, kHistogramBuckets> histogram_{};
+    std::atomic<uint64_t> oversize_{0};
+    std::atomic<int64_t> trim_interval_micros_{10 * 1000000};
+    std::atomic<int64_t> last_trim_micros_{0};
 };
 
 using PooledBuffer = BufferMemoryPool::PooledBuffer;
\ No newline at end of file
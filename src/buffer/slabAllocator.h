@@ -0,0 +1,109 @@
+#pragma once
+
+#include "noncopyable.h"
+
+#include <memory>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+
+/**
+ * fixed-size object slab, NOT thread-safe
+ * one instance per eventloop, every allocate/deallocate happens on the loop thread
+ *
+ * memory is carved from chunks of `slots_per_chunk` slots and never handed back
+ * to the heap while the slab lives, so a freed slot can still be inspected:
+ * each slot has a header with a generation, bumped on every allocate/deallocate,
+ * a (pointer, generation) pair is a cheap weak reference that detects reuse
+ */
+class SlabAllocator : Noncopyable {
+public:
+    static constexpr size_t kCacheLine = 64;
+
+    SlabAllocator(size_t object_size, size_t slots_per_chunk = 256)
+        : slot_size_(kHeaderSize + roundUp(object_size, kCacheLine))
+        , slots_per_chunk_(slots_per_chunk) {}
+
+    ~SlabAllocator() = default;
+
+    // storage for one object, constructed by caller with placement new
+    void* allocate() {
+        if (free_list_.empty()) grow();
+        SlotHeader *h = free_list_.back();
+        free_list_.pop_back();
+        ++h->generation;        // odd: live
+        ++live_;
+        ++total_allocs_;
+        return objectOf(h);
+    }
+
+    // object must already be destroyed by caller
+    void deallocate(void *obj) {
+        if (!obj) return;
+        SlotHeader *h = headerOf(obj);
+        ++h->generation;        // even: free
+        free_list_.push_back(h);
+        --live_;
+        ++total_frees_;
+    }
+
+    // generation of a live object, used to build weak handles
+    static uint32_t generation(const void *obj) { return headerOf(obj)->generation; }
+
+    // true if obj is still the same allocation that had `gen`
+    static bool alive(const void *obj, uint32_t gen) {
+        return obj && (gen & 1u) && headerOf(obj)->generation == gen;
+    }
+
+    // visit every live object, fn may deallocate the one it is given
+    template <typename Fn>
+    void forEachLive(Fn fn) {
+        for (size_t c = 0; c < chunks_.size(); ++c) {
+            char *chunk = chunks_[c].get();
+            for (size_t i = 0; i < slots_per_chunk_; ++i) {
+                SlotHeader *h = reinterpret_cast<SlotHeader*>(chunk + i * slot_size_);
+                if (h->generation & 1u) fn(objectOf(h));
+            }
+        }
+    }
+
+    size_t live() const { return live_; }
+    size_t capacity() const { return chunks_.size() * slots_per_chunk_; }
+    uint64_t total_allocs() const { return total_allocs_; }
+    uint64_t total_frees() const { return total_frees_; }
+
+private:
+    struct alignas(kCacheLine) SlotHeader {
+        uint32_t generation = 0;
+    };
+
+    static constexpr size_t roundUp(size_t n, size_t align) { return (n + align - 1) / align * align; }
+    static constexpr size_t kHeaderSize = sizeof(SlotHeader);    // one cache line
+
+    static SlotHeader* headerOf(const void *obj) {
+        return reinterpret_cast<SlotHeader*>(const_cast<char*>(static_cast<const char*>(obj)) - kHeaderSize);
+    }
+    static void* objectOf(SlotHeader *h) { return reinterpret_cast<char*>(h) + kHeaderSize; }
+
+    void grow() {
+        char *chunk = static_cast<char*>(::operator new(slot_size_ * slots_per_chunk_, std::align_val_t(kCacheLine)));
+        chunks_.emplace_back(chunk);
+        // push in reverse so slots are handed out in address order
+        for (size_t i = slots_per_chunk_; i > 0; --i) {
+            free_list_.push_back(new (chunk + (i - 1) * slot_size_) SlotHeader{});
+        }
+    }
+
+    struct ChunkDeleter {
+        void operator()(char *p) const { ::operator delete(p, std::align_val_t(kCacheLine)); }
+    };
+
+    const size_t slot_size_;
+    const size_t slots_per_chunk_;
+    std::vector<std::unique_ptr<char, ChunkDeleter>> chunks_;
+    std::vector<SlotHeader*> free_list_;   // LIFO, keeps recently freed slots hot in cache
+    size_t live_ = 0;
+    uint64_t total_allocs_ = 0;
+    uint64_t total_frees_ = 0;
+};
@@ -0,0 +1,115 @@
+#pragma once
+
+#include "noncopyable.h"
+
+#include <vector>
+#include <new>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <unistd.h>
+#include <sys/mman.h>
+
+struct SlabArenaOptions {
+    bool hugepages = false;
+    bool populate = false;
+    size_t regionBytes = 2 * 1024 * 1024;   // rounded up to a huge page
+};
+
+/**
+ * bump allocator over large anonymous mappings, NOT thread-safe
+ * everything carved lives until the arena dies, there is no free
+ *
+ * regions are 2MB aligned so the kernel can back them with huge pages:
+ * explicit MAP_HUGETLB pages when asked for and reserved ( vm.nr_hugepages ),
+ * otherwise transparent huge pages through MADV_HUGEPAGE
+ * populate pre-faults a region when it is mapped, keeping page faults off the hot path
+ */
+class SlabArena : Noncopyable {
+public:
+    static constexpr size_t kCacheLine = 64;
+    static constexpr size_t kHugePage = 2 * 1024 * 1024;
+
+    using Options = SlabArenaOptions;
+
+    explicit SlabArena(const Options &options = Options()) : options_(options) {}
+
+    ~SlabArena() {
+        for (auto &r : regions_) ::munmap(r.base, r.size);
+    }
+
+    // cache-line aligned block of at least bytes
+    void* carve(size_t bytes) {
+        bytes = roundUp(bytes, kCacheLine);
+        if (regions_.empty() || used_ + bytes > regions_.back().size) map(bytes);
+        char *p = regions_.back().base + used_;
+        used_ += bytes;
+        return p;
+    }
+
+    size_t mappedBytes() const {
+        size_t n = 0;
+        for (auto &r : regions_) n += r.size;
+        return n;
+    }
+    // regions backed by explicit ( MAP_HUGETLB ) huge pages
+    size_t hugetlbRegions() const {
+        return std::count_if(regions_.begin(), regions_.end(), [](const Region &r) { return r.hugetlb; });
+    }
+
+private:
+    struct Region {
+        char *base;
+        size_t size;
+        bool hugetlb;
+    };
+
+    static constexpr size_t roundUp(size_t n, size_t align) { return (n + align - 1) / align * align; }
+
+    void map(size_t atLeast) {
+        size_t size = roundUp(std::max(atLeast, options_.regionBytes), kHugePage);
+        int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+        if (options_.hugepages) {
+            void *p = ::mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                             flags | MAP_HUGETLB | (options_.populate ? MAP_POPULATE : 0), -1, 0);
+            if (p != MAP_FAILED) {
+                push({ static_cast<char*>(p), size, true });
+                return;
+            }
+            // no reserved huge pages, fall back to transparent ones
+        }
+
+        // over-map by one huge page and cut the ends off, leaving a 2MB aligned region
+        size_t span = size + kHugePage;
+        void *raw = ::mmap(nullptr, span, PROT_READ | PROT_WRITE, flags, -1, 0);
+        if (raw == MAP_FAILED) throw std::bad_alloc();
+        uintptr_t start = roundUp(reinterpret_cast<uintptr_t>(raw), kHugePage);
+        size_t head = start - reinterpret_cast<uintptr_t>(raw);
+        if (head) ::munmap(raw, head);
+        if (span - head - size) ::munmap(reinterpret_cast<char*>(start) + size, span - head - size);
+        char *base = reinterpret_cast<char*>(start);
+
+        if (options_.hugepages) ::madvise(base, size, MADV_HUGEPAGE);
+        if (options_.populate) prefault(base, size);
+        push({ base, size, false });
+    }
+
+    static void prefault(char *base, size_t size) {
+#ifdef MADV_POPULATE_WRITE
+        if (::madvise(base, size, MADV_POPULATE_WRITE) == 0) return;
+#endif
+        // older kernels: touch every page ourselves
+        long page = ::sysconf(_SC_PAGESIZE);
+        for (size_t off = 0; off < size; off += static_cast<size_t>(page)) base[off] = 0;
+    }
+
+    void push(const Region &r) {
+        regions_.push_back(r);
+        used_ = 0;
+    }
+
+    Options options_;
+    std::vector<Region> regions_;
+    size_t used_ = 0;       // bytes carved from the last region
+};
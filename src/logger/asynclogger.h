@@ -0,0 +1,299 @@
+#pragma once
+
+#include "logger.h"
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+#include <string>
+#include <string_view>
+#include <cstring>
+#include <cstdint>
+#include <tuple>
+#include <type_traits>
+
+/**
+ * deferred ( binary ) logging
+ * the call site only copies raw argument bytes and the address of a static LogSite
+ * ( file, line, function, format ) into a shared buffer;
+ * printf-style rendering, timestamp formatting and the actual write happen
+ * on a backend thread
+ *
+ * arguments: arithmetic, enums, pointers are copied as-is,
+ * const char* / std::string / std::string_view are copied inline and render with %s
+ */
+struct LogSite {
+    LogLevel level;
+    const char *file;
+    int line;
+    const char *function;
+    const char *fmt;
+};
+
+namespace async_log_detail {
+
+    template<typename T>
+    struct IsString : std::bool_constant<
+        std::is_same_v<T, const char*> || std::is_same_v<T, char*> ||
+        std::is_same_v<T, std::string> || std::is_same_v<T, std::string_view>> {};
+
+    template<typename T>
+    using Stored = std::decay_t<T>;
+
+    // what the backend hands to snprintf for an argument of type T
+    template<typename T>
+    using Decoded = std::conditional_t<IsString<Stored<T>>::value, const char*, Stored<T>>;
+
+    template<typename T>
+    std::string_view asView(const T &v) {
+        if constexpr (std::is_pointer_v<Stored<T>>) {
+            const char *p = v;
+            return p ? std::string_view(p) : std::string_view("(null)");
+        } else {
+            return std::string_view(v);
+        }
+    }
+
+    template<typename T>
+    size_t encodedSize(const T &v) {
+        using U = Stored<T>;
+        if constexpr (IsString<U>::value) {
+            return sizeof(uint32_t) + asView(v).size() + 1;
+        } else {
+            static_assert(std::is_trivially_copyable_v<U>, "LOGB arguments must be trivially copyable or strings");
+            return sizeof(U);
+        }
+    }
+
+    template<typename T>
+    char* encode(char *p, const T &v) {
+        using U = Stored<T>;
+        if constexpr (IsString<U>::value) {
+            std::string_view sv = asView(v);
+            uint32_t len = static_cast<uint32_t>(sv.size());
+            std::memcpy(p, &len, sizeof(len));
+            std::memcpy(p + sizeof(len), sv.data(), len);
+            p[sizeof(len) + len] = '\0';
+            return p + sizeof(len) + len + 1;
+        } else {
+            U u = v;
+            std::memcpy(p, &u, sizeof(U));
+            return p + sizeof(U);
+        }
+    }
+
+    template<typename T>
+    Decoded<T> decode(const char *&p) {
+        using U = Stored<T>;
+        if constexpr (IsString<U>::value) {
+            uint32_t len;
+            std::memcpy(&len, p, sizeof(len));
+            const char *s = p + sizeof(len);
+            p += sizeof(len) + len + 1;
+            return s;       // nul-terminated by encode
+        } else {
+            U u;
+            std::memcpy(&u, p, sizeof(U));
+            p += sizeof(U);
+            return u;
+        }
+    }
+
+    // compile-time only: LOGB passes the literal format and what each argument renders as,
+    // so the compiler's printf checking applies to the call site, nothing runs
+    __attribute__((format(printf, 1, 2))) inline void formatCheck(const char *, ...) {}
+
+    template<typename T>
+    auto formatArg(const T &v) {
+        using U = Stored<T>;
+        if constexpr (IsString<U>::value) {
+            return static_cast<const char*>(nullptr);
+        } else if constexpr (std::is_enum_v<U>) {
+            return static_cast<std::underlying_type_t<U>>(v);
+        } else {
+            return static_cast<U>(v);
+        }
+    }
+
+    // instantiated per argument type list at the call site, runs on the backend
+    template<typename... Args>
+    void render(const LogSite &site, const char *payload, std::string &out) {
+        const char *p = payload;
+        (void)p;    // unused when there are no arguments
+        // braced init keeps left-to-right decode order
+        std::tuple<Decoded<Args>...> args{ decode<Args>(p)... };
+        // the format was checked against these types where LOGB was written
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wformat-nonliteral"
+#pragma GCC diagnostic ignored "-Wformat-security"
+        std::apply([&](auto... a) {
+            char stack[512];
+            int n = snprintf(stack, sizeof(stack), site.fmt, a...);
+            if (n < 0) {
+                out += "(logger format error)";
+            } else if (static_cast<size_t>(n) < sizeof(stack)) {
+                out.append(stack, static_cast<size_t>(n));
+            } else {
+                size_t old = out.size();
+                out.resize(old + static_cast<size_t>(n) + 1);
+                snprintf(&out[old], static_cast<size_t>(n) + 1, site.fmt, a...);
+                out.resize(old + static_cast<size_t>(n));
+            }
+        }, args);
+#pragma GCC diagnostic pop
+    }
+
+    using RenderFn = void (*)(const LogSite&, const char*, std::string&);
+
+    struct RecordHeader {
+        uint32_t size;          // whole record, header included
+        const LogSite *site;    // static per call site, doubles as its id
+        RenderFn render;
+        int64_t microSecondsSinceEpoch;
+    };
+}
+
+class AsyncLogger : Noncopyable {
+public:
+    static AsyncLogger& instance() {
+        static AsyncLogger logger;
+        return logger;
+    }
+
+    void set_output(std::ostream &output) {
+        std::lock_guard lock(outputMutex_);
+        output_ = &output;
+    }
+
+    // hot path: one memcpy of header + raw arguments under a short lock
+    template<typename... Args>
+    void push(const LogSite &site, const Args&... args) {
+        using namespace async_log_detail;
+        size_t size = sizeof(RecordHeader) + (size_t(0) + ... + encodedSize(args));
+        RecordHeader header{ static_cast<uint32_t>(size), &site, &render<Args...>, TimeStamp::now().microSecondsSinceEpoch() };
+
+        bool wake = false;
+        {
+            std::lock_guard lock(mutex_);
+            size_t offset = front_.size();
+            front_.resize(offset + size);
+            char *p = front_.data() + offset;
+            std::memcpy(p, &header, sizeof(header));
+            p += sizeof(header);
+            ((p = encode(p, args)), ...);
+            wake = front_.size() >= kFlushThreshold;
+        }
+        if (wake) cond_.notify_one();
+    }
+
+    // render and write everything pushed so far, from the calling thread
+    void flush() {
+        std::lock_guard drain(drainMutex_);
+        // two persistent buffers trade places, both keep their capacity:
+        // nothing is allocated while producers wait on the lock
+        back_.clear();
+        {
+            std::lock_guard lock(mutex_);
+            back_.swap(front_);
+        }
+        write(back_);
+    }
+
+    ~AsyncLogger() {
+        {
+            std::lock_guard lock(mutex_);
+            running_ = false;
+        }
+        cond_.notify_one();
+        if (backend_.joinable()) backend_.join();
+        flush();
+    }
+
+private:
+    static constexpr size_t kFlushThreshold = 1024 * 1024;
+
+    AsyncLogger() : output_(&std::cout) {
+        front_.reserve(kFlushThreshold * 2);
+        back_.reserve(kFlushThreshold * 2);
+        backend_ = std::thread([this] { backendLoop(); });
+    }
+
+    void backendLoop() {
+        std::unique_lock lock(mutex_);
+        while (running_) {
+            cond_.wait_for(lock, std::chrono::milliseconds(100));
+            lock.unlock();
+            flush();
+            lock.lock();
+        }
+    }
+
+    void write(const std::vector<char> &batch) {
+        using namespace async_log_detail;
+        static const char* levels[] = {"DEBUG", "INFO", "WARN", "ERROR", "FATAL"};
+        line_.clear();
+        const char *p = batch.data();
+        const char *end = p + batch.size();
+        while (p < end) {
+            RecordHeader header;
+            std::memcpy(&header, p, sizeof(header));
+            const LogSite &site = *header.site;
+            line_ += "[";
+            char time[TimeStamp::kFormattedSize];
+            line_.append(time, TimeStamp(header.microSecondsSinceEpoch).formatTo(time));
+            line_ += "] [";
+            line_ += levels[static_cast<int>(site.level)];
+            line_ += "] [";
+            line_ += site.file;
+            line_ += ":";
+            line_ += std::to_string(site.line);
+            line_ += " ";
+            line_ += site.function;
+            line_ += "() ] ";
+            header.render(site, p + sizeof(header), line_);
+            line_ += '\n';
+            p += header.size;
+        }
+        if (line_.empty()) return;
+        std::lock_guard lock(outputMutex_);
+        output_->write(line_.data(), static_cast<std::streamsize>(line_.size()));
+        output_->flush();
+    }
+
+    std::mutex mutex_;          // guards front_ and running_
+    std::condition_variable cond_;
+    std::vector<char> front_;   // encoded records, appended by producers
+    bool running_ = true;
+
+    std::mutex drainMutex_;     // one renderer at a time ( backend or explicit flush )
+    std::string line_;          // render scratch, reused
+    std::vector<char> back_;    // the batch being rendered, swapped with front_
+
+    std::mutex outputMutex_;
+    std::ostream *output_;
+    std::thread backend_;
+};
+
+
+// deferred printf-style logging, e.g. LOGB(LogLevel::ERROR, "epoll_ctl failed on fd %d", fd)
+// same compile-time and runtime level filters as LOG(), the format must be a literal
+// and is checked against the arguments like printf's ( -Wformat )
+#define LOGB(level, fmt, ...) \
+    do { \
+        if (false) [](const auto&... a) { \
+            async_log_detail::formatCheck(fmt, async_log_detail::formatArg(a)...); \
+        }(__VA_ARGS__); \
+        if constexpr (static_cast<int>(level) >= LOG_MIN_LEVEL) { \
+            if (Logger::instance().enabled(level)) { \
+                static const LogSite kLogSite{ level, LOG_FILENAME, __LINE__, __func__, fmt }; \
+                AsyncLogger::instance().push(kLogSite, ##__VA_ARGS__); \
+            } \
+        } \
+    } while (0)
+
+#define LOGB_DEBUG(fmt, ...) LOGB(LogLevel::DEBUG, fmt, ##__VA_ARGS__)
+#define LOGB_INFO(fmt, ...)  LOGB(LogLevel::INFO,  fmt, ##__VA_ARGS__)
+#define LOGB_WARN(fmt, ...)  LOGB(LogLevel::WARN,  fmt, ##__VA_ARGS__)
+#define LOGB_ERROR(fmt, ...) LOGB(LogLevel::ERROR, fmt, ##__VA_ARGS__)
+#define LOGB_FATAL(fmt, ...) LOGB(LogLevel::FATAL, fmt, ##__VA_ARGS__)
@@ -1,56 +1,114 @@
+#pragma once
+
 #include <iostream>
-#include <sstream>
 #include <mutex>
 #include <cstdarg>
 #include <cstdio>
+#include <cstddef>
+#include <cerrno>
 #include <atomic>
-#include <filesystem>
+#include <type_traits>
 
 #include "noncopyable.h"
 #include "timestamp.h"
 
-namespace{
-    std::string get_filename(const std::string& full_path) {
-        return std::filesystem::path(full_path).filename().string();
+// compile-time floor, levels below it compile to nothing
+// 0 DEBUG, 1 INFO, 2 WARN, 3 ERROR, 4 FATAL, e.g. -DLOG_MIN_LEVEL=1 for release builds
+#ifndef LOG_MIN_LEVEL
+#define LOG_MIN_LEVEL 0
+#endif
+
+namespace log_detail{
+    // offset of the file name in __FILE__, evaluated by the compiler
+    constexpr size_t basenameOffset(const char* path) {
+        size_t offset = 0;
+        for (size_t i = 0; path[i] != '\0'; ++i) {
+            if (path[i] == '/') offset = i + 1;
+        }
+        return offset;
+    }
+}
+
+namespace log_detail{
+    /**
+     * state of one rate-limited call site, a function-local static per macro expansion
+     * lock-free, a dropped message costs one relaxed fetch_add
+     * the next message that gets through reports how many were dropped before it
+     */
+    struct RateSite {
+        std::atomic<uint64_t> count{0};
+        std::atomic<int64_t> lastMicros{0};
+        std::atomic<uint64_t> suppressed{0};
+
+        // 1st, (n+1)th, (2n+1)th ...
+        bool everyN(uint64_t n) {
+            if (count.fetch_add(1, std::memory_order_relaxed) % (n ? n : 1) == 0) return true;
+            suppressed.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+
+        // at most one per interval, the thread winning the CAS logs
+        bool everyT(double seconds) {
+            int64_t now = TimeStamp::nowCoarse().microSecondsSinceEpoch();
+            int64_t last = lastMicros.load(std::memory_order_relaxed);
+            if ((last == 0 || now - last >= static_cast<int64_t>(seconds * 1000000))
+                && lastMicros.compare_exchange_strong(last, now, std::memory_order_relaxed)) {
+                return true;
+            }
+            suppressed.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+
+        // the first n, then a summary at most once a minute so a storm stays visible
+        bool firstN(uint64_t n) {
+            uint64_t c = count.fetch_add(1, std::memory_order_relaxed);
+            if (c + 1 == n) lastMicros.store(TimeStamp::nowCoarse().microSecondsSinceEpoch(), std::memory_order_relaxed);
+            if (c < n) return true;
+            return everyT(60.0);
+        }
+    };
+
+    struct Suppressed { uint64_t n; };
+
+    inline std::ostream& operator<<(std::ostream &os, Suppressed s) {
+        if (s.n) os << "[suppressed " << s.n << " messages] ";
+        return os;
     }
 }
 
+#define LOG_FILENAME (__FILE__ + std::integral_constant<size_t, ::log_detail::basenameOffset(__FILE__)>::value)
+
 enum class LogLevel  { DEBUG, INFO, WARN, ERROR, FATAL };
 
 /** singleton logger 
- * TODO: add compile option support
+ * level filtering: compile time with LOG_MIN_LEVEL, then one relaxed load at runtime,
+ * both before anything is constructed
 */
 class Logger  : Noncopyable {
 public:
 
-    class LogStream{    // lifetime within a single log
+    class LogStream{    // lifetime within a single log, only built once the level passed
     public:
         LogStream(LogLevel msgLevel, const char* file, int line, const char* function, Logger &logger) 
-        : enabled_(msgLevel >= logger.get_level() ), logger_(logger) {
-            if(enabled_){
-                logger_.write_header(msgLevel, file, line, function);
-            }
+        : logger_(logger) {
+            // the header is written before the arguments are evaluated,
+            // keep errno intact for a strerror(errno) further down the statement
+            int savedErrno = errno;
+            logger_.write_header(msgLevel, file, line, function);
+            errno = savedErrno;
         }
 
         ~LogStream() {  // nextline when flush
-            if(enabled_){
-                // logger_.write_message(stream_.str());
-                logger_.write_footer();
-            }
+            logger_.write_footer();
         }
         
         template<typename T>
         LogStream& operator<<(const T& value) {
-            if (enabled_) {
-                // stream_ << value;
-                logger_.write_content(value);
-            }
+            logger_.write_content(value);
             return *this;
         }
         
     private:
-        bool enabled_;
-        std::ostringstream stream_;
         Logger &logger_;
     };
 
@@ -72,6 +130,11 @@ public:
         return level_.load(std::memory_order_acquire);
     }
 
+    // hot path filter, ordering does not matter for a level
+    bool enabled(LogLevel msgLevel) const {
+        return msgLevel >= level_.load(std::memory_order_relaxed);
+    }
+
     // printf-style formatting support
     void logf(LogLevel msgLevel, const char* file, int line, const char* function, const char* fmt, ...) {
         if (msgLevel < level_) return;
@@ -108,11 +171,13 @@ private:
     }
 
     void write_header(LogLevel level, const char* file, int line, const char* function) {
+        char time[TimeStamp::kFormattedSize];
+        TimeStamp::now().formatTo(time);    // per-thread cached, outside the lock
         std::lock_guard lock(mutex_);
         if (output_ && level >= level_) {
-            *output_ << "[" << TimeStamp::now().toFormattedString() << "] "
+            *output_ << "[" << time << "] "
                      << "[" << toString(level) << "] "
-                     << "[" << get_filename(file) << ":" << line << " " << function <<  "() ] ";
+                     << "[" << file << ":" << line << " " << function <<  "() ] ";
         }
     }
 
@@ -152,8 +217,26 @@ private:
 
 
 // stream style logging
+// the if/else shape keeps `if (x) LOG_INFO << ...; else ...` binding correctly
 #define LOG(level) \
-    Logger::LogStream(level, __FILE__, __LINE__, __func__, Logger::instance())
+    if constexpr (static_cast<int>(level) < LOG_MIN_LEVEL) {} \
+    else if (!Logger::instance().enabled(level)) {} \
+    else Logger::LogStream(level, LOG_FILENAME, __LINE__, __func__, Logger::instance())
+
+// rate-limited stream logging, one static counter per call site
+// LOG_EVERY_N(LogLevel::ERROR, 1000) << ...   1 in n
+// LOG_FIRST_N(LogLevel::ERROR, 10) << ...     first n, then one summary a minute
+// LOG_EVERY_T(LogLevel::ERROR, 1.0) << ...    at most one per t seconds
+#define LOG_RATE_LIMITED(level, check) \
+    if constexpr (static_cast<int>(level) < LOG_MIN_LEVEL) {} \
+    else if (!Logger::instance().enabled(level)) {} \
+    else if (static ::log_detail::RateSite logSite_; !logSite_.check) {} \
+    else Logger::LogStream(level, LOG_FILENAME, __LINE__, __func__, Logger::instance()) \
+            << ::log_detail::Suppressed{logSite_.suppressed.exchange(0, std::memory_order_relaxed)}
+
+#define LOG_EVERY_N(level, n)       LOG_RATE_LIMITED(level, everyN(n))
+#define LOG_FIRST_N(level, n)       LOG_RATE_LIMITED(level, firstN(n))
+#define LOG_EVERY_T(level, seconds) LOG_RATE_LIMITED(level, everyT(seconds))
 
 #define LOG_DEBUG LOG(LogLevel::DEBUG)
 #define LOG_INFO  LOG(LogLevel::INFO)
@@ -164,7 +247,11 @@ private:
 
 // printf style logging
 #define LOGF(level, fmt, ...) \
-    Logger::instance().logf(level, __FILE__, __LINE__, __func__, fmt, ##__VA_ARGS__)
+    do { \
+        if constexpr (static_cast<int>(level) >= LOG_MIN_LEVEL) { \
+            Logger::instance().logf(level, LOG_FILENAME, __LINE__, __func__, fmt, ##__VA_ARGS__); \
+        } \
+    } while (0)
 
 #define LOGF_DEBUG(fmt, ...) LOGF(LogLevel::DEBUG, fmt, ##__VA_ARGS__)
 #define LOGF_INFO(fmt, ...)  LOGF(LogLevel::INFO,  fmt, ##__VA_ARGS__)
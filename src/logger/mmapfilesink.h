@@ -0,0 +1,268 @@
+#pragma once
+
+#include "noncopyable.h"
+#include "timestamp.h"
+
+#include <string>
+#include <vector>
+#include <ostream>
+#include <streambuf>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <cstring>
+#include <cstdio>
+#include <ctime>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+/**
+ * rolling log file written through a shared memory mapping
+ * - each file is preallocated ( fallocate ) and mapped once, an append is a memcpy,
+ *   no write syscall per line
+ * - rolls when the file is full or the time period ends, the next file is
+ *   prepared ahead of time by the background thread
+ * - msync / madvise and closing retired files also run on the background thread
+ * - crash-safe: bytes copied into a MAP_SHARED mapping live in the page cache,
+ *   a dying process loses nothing; the unwritten tail of a crashed file reads as zeros
+ *   ( a clean roll or close truncates it )
+ *
+ * append() is not thread-safe, the caller serializes it ( Logger holds its mutex )
+ * plug into Logger / AsyncLogger with set_output(sink.stream())
+ */
+class MmapFileSink : Noncopyable {
+public:
+    explicit MmapFileSink(std::string basename,
+                          size_t rollSize = 64 * 1024 * 1024,
+                          int rollIntervalSeconds = 24 * 3600,
+                          int syncIntervalMs = 1000)
+        : basename_(std::move(basename))
+        , rollSize_(rollSize)
+        , rollInterval_(rollIntervalSeconds)
+        , syncInterval_(syncIntervalMs)
+        , streambuf_(this)
+        , stream_(&streambuf_) {
+        openMapping(&current_, nextFileName());
+        periodStart_ = periodOf(TimeStamp::nowCoarse().secondsSinceEpoch());
+        background_ = std::thread([this] { backgroundLoop(); });
+    }
+
+    ~MmapFileSink() {
+        {
+            std::lock_guard lock(mutex_);
+            running_ = false;
+        }
+        cond_.notify_one();
+        if (background_.joinable()) background_.join();
+        closeMapping(current_, offset_);
+        if (next_.base) {
+            closeMapping(next_, 0);
+            ::unlink(pendingFileName().c_str());
+        }
+    }
+
+    void append(const char *data, size_t len) {
+        int64_t now = TimeStamp::nowCoarse().secondsSinceEpoch();
+        if (periodOf(now) != periodStart_) {
+            periodStart_ = periodOf(now);
+            roll(now);      // on failure the current file just keeps going
+        }
+        while (len > 0) {
+            if (offset_ == current_.size && !roll(now)) {
+                // no file to write to ( e.g. disk full ): stderr gets the rest, never spin
+                dropped_.fetch_add(1, std::memory_order_relaxed);
+                fwrite(data, 1, len, stderr);
+                break;
+            }
+            size_t n = std::min(len, current_.size - offset_);
+            std::memcpy(current_.base + offset_, data, n);
+            offset_ += n;
+            data += n;
+            len -= n;
+        }
+        written_.store(offset_, std::memory_order_release);
+    }
+
+    // appends that went to stderr because no log file could be opened
+    uint64_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+    std::ostream& stream() { return stream_; }
+
+private:
+    struct Mapping {
+        int fd = -1;
+        char *base = nullptr;
+        size_t size = 0;
+    };
+
+    // adapter so the existing ostream-based loggers can target the sink
+    class StreamBuf : public std::streambuf {
+    public:
+        explicit StreamBuf(MmapFileSink *sink) : sink_(sink) {}
+    protected:
+        std::streamsize xsputn(const char *s, std::streamsize n) override {
+            sink_->append(s, static_cast<size_t>(n));
+            return n;
+        }
+        int_type overflow(int_type c) override {
+            if (c != traits_type::eof()) {
+                char ch = traits_type::to_char_type(c);
+                sink_->append(&ch, 1);
+            }
+            return traits_type::not_eof(c);
+        }
+        int sync() override { return 0; }     // nothing buffered, std::endl is free
+    private:
+        MmapFileSink *sink_;
+    };
+
+    int64_t periodOf(int64_t seconds) const { return rollInterval_ > 0 ? seconds / rollInterval_ : 0; }
+
+    std::string nextFileName() {
+        char buf[64];
+        std::time_t t = static_cast<std::time_t>(TimeStamp::nowCoarse().secondsSinceEpoch());
+        tm tm_time;
+        localtime_r(&t, &tm_time);
+        strftime(buf, sizeof(buf), ".%Y%m%d-%H%M%S", &tm_time);
+        // sequence number, several size rolls may happen within one second
+        return basename_ + buf + "." + std::to_string(::getpid()) + "." + std::to_string(fileSeq_++) + ".log";
+    }
+
+    // the file prepared ahead, renamed to its real name when it becomes current,
+    // so names follow the order files are written in
+    std::string pendingFileName() const { return basename_ + ".next." + std::to_string(::getpid()) + ".log"; }
+
+    bool openMapping(Mapping *m, const std::string &path) {
+        int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            perror("MmapFileSink open");
+            return false;
+        }
+        // reserve blocks up front, a full disk shows up here rather than as SIGBUS later
+        if (::posix_fallocate(fd, 0, static_cast<off_t>(rollSize_)) != 0) {
+            perror("MmapFileSink fallocate");
+            ::close(fd);
+            return false;
+        }
+        void *p = ::mmap(nullptr, rollSize_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (p == MAP_FAILED) {
+            perror("MmapFileSink mmap");
+            ::close(fd);
+            return false;
+        }
+        m->fd = fd;
+        m->base = static_cast<char*>(p);
+        m->size = rollSize_;
+        return true;
+    }
+
+    // async flush, drop the tail of preallocation, release the mapping
+    static void closeMapping(const Mapping &m, size_t used) {
+        if (!m.base) return;
+        ::msync(m.base, used, MS_ASYNC);
+        ::munmap(m.base, m.size);
+        if (::ftruncate(m.fd, static_cast<off_t>(used)) != 0) perror("MmapFileSink ftruncate");
+        ::close(m.fd);
+    }
+
+    // switch to a fresh file, false ( current file kept ) if none could be opened
+    bool roll(int64_t now) {
+        if (now < rollRetryAt_) return false;
+        Mapping fresh;
+        std::string path = nextFileName();
+        {
+            std::lock_guard lock(mutex_);
+            fresh = next_;
+            next_ = Mapping();
+            // rename before the background may create the next pending file
+            if (fresh.base && ::rename(pendingFileName().c_str(), path.c_str()) != 0) perror("MmapFileSink rename");
+        }
+        if (!fresh.base && !openMapping(&fresh, path)) {
+            fprintf(stderr, "MmapFileSink roll failed, retrying in a second\n");
+            rollRetryAt_ = now + 1;
+            cond_.notify_one();     // background tries to prepare a next_ meanwhile
+            return false;
+        }
+        {
+            // the old mapping is handed to the background only once it is replaced
+            std::lock_guard lock(mutex_);
+            if (current_.base) retired_.push_back({ current_, offset_ });
+            current_ = fresh;
+            offset_ = 0;
+            synced_ = 0;
+            written_.store(0, std::memory_order_release);
+        }
+        cond_.notify_one();     // background closes the old one and prepares a new next_
+        return true;
+    }
+
+    void backgroundLoop() {
+        std::unique_lock lock(mutex_);
+        while (running_) {
+            cond_.wait_for(lock, std::chrono::milliseconds(syncInterval_));
+
+            std::vector<std::pair<Mapping, size_t>> retired;
+            retired.swap(retired_);
+            bool needNext = running_ && !next_.base;
+            Mapping cur = current_;
+            size_t from = synced_;
+            size_t to = std::min(written_.load(std::memory_order_acquire), cur.size);
+            lock.unlock();
+
+            for (auto &r : retired) closeMapping(r.first, r.second);
+
+            // push out what the hot path wrote since last time, then drop the
+            // fully written pages from our page tables to keep RSS flat
+            static const size_t kPage = static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+            size_t begin = from / kPage * kPage;
+            size_t end = to / kPage * kPage;
+            if (cur.base && to > from) {
+                ::msync(cur.base + begin, to - begin, MS_ASYNC);
+                if (end > begin) ::madvise(cur.base + begin, end - begin, MADV_DONTNEED);
+            }
+
+            Mapping prepared;
+            if (needNext) openMapping(&prepared, pendingFileName());
+
+            lock.lock();
+            if (cur.base == current_.base) synced_ = end;
+            if (prepared.base) {
+                if (!next_.base && running_) {
+                    next_ = prepared;
+                } else {
+                    lock.unlock();
+                    closeMapping(prepared, 0);
+                    ::unlink(pendingFileName().c_str());
+                    lock.lock();
+                }
+            }
+        }
+    }
+
+    const std::string basename_;
+    const size_t rollSize_;
+    const int rollInterval_;
+    const int syncInterval_;
+
+    Mapping current_;           // written by the hot path, swapped under mutex_
+    size_t offset_ = 0;
+    std::atomic<size_t> written_{0};
+    int64_t periodStart_ = 0;
+
+    uint64_t fileSeq_ = 0;      // hot path only
+    int64_t rollRetryAt_ = 0;   // hot path only, seconds
+    std::atomic<uint64_t> dropped_{0};
+
+    std::mutex mutex_;          // guards next_, retired_, synced_, running_ and current_ swaps
+    std::condition_variable cond_;
+    Mapping next_;              // prepared ahead by the background thread
+    std::vector<std::pair<Mapping, size_t>> retired_;
+    size_t synced_ = 0;
+    bool running_ = true;
+    std::thread background_;
+
+    StreamBuf streambuf_;
+    std::ostream stream_;
+};
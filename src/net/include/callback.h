@@ -2,16 +2,28 @@
 
 #include <functional>
 #include <memory>
-#include "tcpconnection.h"
+#include "ref_counted.h"
 
 
 class TcpConnection;
-class Buffer;
+namespace buffer_internal { class Buffer; }
+using Buffer = buffer_internal::Buffer;
 class TimeStamp;
+class InetAddress;
+class UdpChannel;
+
+// intrusive, non-atomic: only copy it on the connection's own loop thread
+using TcpConnectionPtr = RefPtr<TcpConnection>;
 
 // like a member function capable of using member variable
-using ConnectionCallback = std::function<void( std::shared_ptr<TcpConnection>) >;
-using ReadDataCallback = std::function<void(std::shared_ptr<TcpConnection>, std::shared_ptr<Buffer>, TimeStamp)>;
-using CloseCallback = std::function<void( std::shared_ptr<TcpConnection>) >;
-using WriteCompleteCallback = std::function<void( std::shared_ptr<TcpConnection>) >;
-using HighWatermarkCallback = std::function<void( std::shared_ptr<TcpConnection> , size_t ) >;
\ No newline at end of file
+using ConnectionCallback = std::function<void(TcpConnectionPtr) >;
+// borrowed view: buf is the connection's input buffer, only valid during the call,
+// consume with buf->retrieve(n), whatever is left stays buffered for the next read
+using MessageCallback = std::function<void(const TcpConnectionPtr&, Buffer*, TimeStamp)>;
+// compatibility: a copy of all readable bytes, handed over as a heap-managed buffer
+using ReadDataCallback = std::function<void(TcpConnectionPtr, std::shared_ptr<Buffer>, TimeStamp)>;
+using CloseCallback = std::function<void(TcpConnectionPtr) >;
+using WriteCompleteCallback = std::function<void(TcpConnectionPtr) >;
+using HighWatermarkCallback = std::function<void(TcpConnectionPtr , size_t ) >;
+// one datagram, data is only valid during the call; reply with channel->send()
+using DatagramCallback = std::function<void(UdpChannel*, const char*, size_t, const InetAddress&, TimeStamp)>;
@@ -4,14 +4,18 @@
 
 #include "logger.h"
 #include "timestamp.h"
-#include "eventloop.h"
 
 #include <functional>
 #include <memory>
+#include <cstdint>
+#include <sys/epoll.h>
 
 
 enum class ChannelState{ INIT, POLLING, REMOVED };
 
+class EventLoop;
+class TcpConnection;
+
 /**
  * each channel owns a (socket) fd to monitor, 
  * manage the events concerned and callback
@@ -29,7 +33,8 @@ public:
     Channel(EventLoop *loop, int fd);
     ~Channel();
 
-    void tie(const std::shared_ptr<void> &conn);
+    // hold a (non-atomic) ref on the owner while its callbacks run
+    void tie(TcpConnection *conn);
     void handleEvent(TimeStamp ts);
 
     // provide best performance for lvalue, rvalue and xvalue
@@ -52,7 +57,7 @@ public:
     void disableAll()      { events_ &= 0; update(); }
 
     // monitor status 
-    bool isNonEvent() const { return events_ | 0; }
+    bool isNonEvent() const { return events_ == 0; }
     bool isReading() const { return events_ & (EPOLLIN | EPOLLPRI); }
     bool isWriting() const { return events_ & EPOLLOUT; }
 
@@ -65,29 +70,28 @@ public:
     void setRevents(int revt) { revents_ = revt; }
     
     // remove from epoller
-    void remove(){
-        loop_->removeChannel(this);
-    }
+    void remove();
 
     ChannelState state() const { return state_; }
     void setState(ChannelState state){ state_ = state; }
 
+    // generation of the fd slot in eventloop's channel table, catches fd reuse
+    uint32_t generation() const { return generation_; }
+    void setGeneration(uint32_t gen){ generation_ = gen; }
+
 private:
-    void update(){
-        loop_->updateChannel(this);     // epoll_ctl 
-    };
+    void update();     // epoll_ctl through the loop
     void handleEventGuarded(TimeStamp ts);
 
     EventLoop *loop_;
     const int fd_;  // socket fd, owned by TCPConnection or TCPServer
-                    // should use a weak_ptr to observe the lifetime of fd_
-    std::weak_ptr<void> tie_;
-    bool tied_;
+    TcpConnection *tie_;    // owner embedding this channel, kept alive during handleEvent
 
     int events_;    // bitmask. see more at enum EPOLL_EVENTS;
     int revents_;   // returned active events
     
     ChannelState state_;
+    uint32_t generation_;
     
 
     ReadEventCallBack readCallBack_;
@@ -0,0 +1,92 @@
+#pragma once
+
+#include "noncopyable.h"
+
+#include <memory>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+class Channel;
+
+/**
+ * flat fd-indexed channel table, replaces unordered_map<int, Channel*>
+ * fds are small dense integers, so index them directly:
+ *  - no hashing, no node allocation per channel
+ *  - paged, a page is allocated only when an fd in its range shows up,
+ *    and pages never move, so a Slot* stays valid while the loop lives
+ *
+ * each slot carries a generation, bumped whenever a new channel takes the fd,
+ * a channel remembers the generation it got, so a stale channel on a reused fd
+ * can be told apart from the current owner
+ */
+class ChannelTable : Noncopyable {
+public:
+    struct Slot {
+        Channel *channel = nullptr;
+        uint32_t generation = 0;
+    };
+
+    ChannelTable() = default;
+    ~ChannelTable() = default;
+
+    // bind fd to channel, return the generation the channel should remember
+    uint32_t insert(int fd, Channel *ch) {
+        Slot *s = slot(fd);
+        if (!s->channel) ++size_;
+        s->channel = ch;
+        return ++s->generation;
+    }
+
+    // unbind fd only if it is still owned by ch ( fd may be reused already )
+    void erase(int fd, const Channel *ch) {
+        Slot *s = peek(fd);
+        if (s && s->channel && s->channel == ch) {
+            s->channel = nullptr;
+            --size_;
+        }
+    }
+
+    Channel* find(int fd) const {
+        const Slot *s = peek(fd);
+        return s ? s->channel : nullptr;
+    }
+
+    // resolve an epoll key, nullptr if the channel left or the fd was reused since
+    Channel* find(int fd, uint32_t generation) const {
+        const Slot *s = peek(fd);
+        return (s && s->generation == generation) ? s->channel : nullptr;
+    }
+
+    // single indexed load, instead of find() + operator[] on a hash map
+    bool contains(int fd, const Channel *ch, uint32_t generation) const {
+        const Slot *s = peek(fd);
+        return s && s->channel == ch && s->generation == generation;
+    }
+
+    size_t size() const { return size_; }
+
+private:
+    static constexpr int kPageBits = 10;
+    static constexpr size_t kPageSize = size_t(1) << kPageBits;  // 1024 slots, 16KB per page
+    static constexpr size_t kPageMask = kPageSize - 1;
+
+    // lookup without allocating, nullptr if the page does not exist
+    Slot* peek(int fd) const {
+        if (fd < 0) return nullptr;
+        size_t page = static_cast<size_t>(fd) >> kPageBits;
+        if (page >= pages_.size() || !pages_[page]) return nullptr;
+        return &pages_[page][static_cast<size_t>(fd) & kPageMask];
+    }
+
+    // lookup and allocate the page on demand
+    Slot* slot(int fd) {
+        size_t page = static_cast<size_t>(fd) >> kPageBits;
+        if (page >= pages_.size()) pages_.resize(page + 1);
+        if (!pages_[page]) pages_[page].reset(new Slot[kPageSize]);
+        return &pages_[page][static_cast<size_t>(fd) & kPageMask];
+    }
+
+    std::vector<std::unique_ptr<Slot[]>> pages_;
+    size_t size_ = 0;
+};
@@ -0,0 +1,69 @@
+#pragma once
+
+#include "noncopyable.h"
+#include "inetaddr.h"
+#include "channel.h"
+#include "timerqueue.h"
+
+#include <functional>
+#include <memory>
+
+class EventLoop;
+
+/**
+ * non-blocking connect with retry
+ * connect() -> EINPROGRESS -> wait for writable -> SO_ERROR, on failure the next
+ * attempt is scheduled on a loop timer with exponential backoff
+ * hands the connected fd over and forgets it, one connector makes one connection per start
+ * loop thread only, except start() / stop() which forward to it
+ */
+class Connector : Noncopyable {
+public:
+    using NewConnectionCallback = std::function<void(int sockfd)>;
+    // an error retrying cannot fix ( e.g. EACCES, EAFNOSUPPORT ), the connector gave up
+    using ConnectFailedCallback = std::function<void(int err)>;
+
+    Connector(EventLoop *loop, const InetAddress &serverAddr);
+    ~Connector();
+
+    void setNewConnectionCallback(NewConnectionCallback cb) { newConnectionCallback_ = std::move(cb); }
+    void setConnectFailedCallback(ConnectFailedCallback cb) { connectFailedCallback_ = std::move(cb); }
+    // backoff starts at initial and doubles up to max
+    void setRetryDelay(double initialSeconds, double maxSeconds) {
+        initialDelay_ = retryDelay_ = initialSeconds;
+        maxDelay_ = maxSeconds;
+    }
+
+    void start();
+    // from scratch, backoff reset, e.g. after an established connection dropped
+    void restart();
+    void stop();
+
+    const InetAddress& serverAddress() const { return serverAddr_; }
+    int attempts() const { return attempts_; }
+
+private:
+    enum class State { DISCONNECTED, CONNECTING, CONNECTED };
+
+    void startInLoop();
+    void connect();
+    void connecting(int sockfd);
+    void handleWrite();
+    void handleError();
+    void retry(int sockfd);
+    // take the fd back from the channel, it stays registered otherwise
+    int removeAndResetChannel();
+
+    EventLoop *loop_;
+    InetAddress serverAddr_;
+    bool connect_ = false;      // wanted by the user
+    State state_ = State::DISCONNECTED;
+    std::unique_ptr<Channel> channel_;  // only while connecting, replaced on the next attempt
+    NewConnectionCallback newConnectionCallback_;
+    ConnectFailedCallback connectFailedCallback_;
+    double initialDelay_ = 0.5;
+    double maxDelay_ = 30.0;
+    double retryDelay_ = 0.5;
+    int attempts_ = 0;
+    TimerId retryTimer_ = 0;
+};
@@ -3,10 +3,15 @@
 #include "noncopyable.h"
 #include "current_thread.h"
 #include "channel.h"
+#include "channeltable.h"
+#include "clock.h"
+#include "timerqueue.h"
+#include "buffer/slabAllocator.h"
 
 #include <functional>
-#include <unordered_map>
 #include <atomic>
+#include <mutex>
+#include <memory>
 #include <sys/epoll.h>
 
 
@@ -16,6 +21,7 @@ class Channel;
  */
 class EventLoop : Noncopyable { /* exclusive ownership of epoll fd */
     public:
+    using Functor = std::function<void()>;
     
     EventLoop();
     ~EventLoop();
@@ -26,8 +32,28 @@ class EventLoop : Noncopyable { /* exclusive ownership of epoll fd */
 
     void wakeup();
 
+    // run cb on the loop thread, immediately if already there
+    void runInLoop(Functor cb);
+    // always defer cb to the end of the current ( or next ) iteration
+    void queueInLoop(Functor cb);
+
+    // timers, thread-safe, the callback runs on the loop thread
+    TimerId runAt(int64_t steadyMicros, Functor cb);
+    TimerId runAfter(double delaySeconds, Functor cb);
+    TimerId runEvery(double intervalSeconds, Functor cb);
+    void cancel(TimerId id);
+
+    // per-loop slab for TcpConnection objects, only touched on the loop thread
+    SlabAllocator& connectionSlab() { return *connectionSlab_; }
+
 
     TimeStamp lastEpollTime(){ return lastEpollTime_; }
+    // cached at the start of this iteration, use instead of reading a clock on the loop thread
+    TimeStamp now() const { return lastEpollTime_; }
+    int64_t steadyMicros() const { return LoopClock::steadyMicros(); }
+    // how far behind the loop runs: smoothed time spent handling a batch, or how
+    // long the current batch has been running if that is longer, thread-safe
+    int64_t lagMicros() const;
     // worker loop, default idle until binding a fd
     void run();
     void stop();
@@ -37,14 +63,15 @@ class EventLoop : Noncopyable { /* exclusive ownership of epoll fd */
 
     
 private:
-    using ChannelList = std::vector<Channel*>;
-    using ChannelMap = std::unordered_map<int, Channel*>;
     using EventList = std::vector<epoll_event>;
-    using Functor = std::function<void()>;
 
     int epollFd_;  //  we don't encapsulate epoller here
     void updateEpoller(int operation, Channel* ch);
 
+    // epoll data carries (generation << 32 | fd) instead of a raw Channel*,
+    // so a channel destroyed earlier in the same batch, or a reused fd, is skipped
+    static uint64_t epollKey(int fd, uint32_t gen) { return (uint64_t(gen) << 32) | uint32_t(fd); }
+
     // use atomic state to support safe inter-thread management
     std::atomic<bool> looping_;
     std::atomic<bool> stop_;
@@ -53,24 +80,29 @@ private:
     // worker thread, managed by main thread
     const pid_t threadId_;
     TimeStamp lastEpollTime_;
-    // TODO: timer
+    std::atomic<int64_t> busySince_{0};     // steady micros the current batch started, 0 while waiting
+    std::atomic<int64_t> lagMicros_{0};
     int wakeupFd_;
     std::unique_ptr<Channel> wakeupChannel_;    // exclusive ownership & lifetime management
     void handleWakeup();  // cb for wakeupfd events
     void doPendingFunctors();   
+    // on destruction: close the connections still carved from our slab
+    void closeConnections();
 
-    ChannelMap channels_;
-    ChannelList activeChannels_;
+    ChannelTable channels_;     // fd -> channel, flat paged array
     EventList eventList_;   // buffer for revents
     enum class WAIT_MODE{
         BLOCKING = -1,
         BUSY_WAIT = 0,
         TIMEOUT = 100 // 100ms
     };
-    const int kEventListSize = 64;
+    static constexpr int kEventListSize = 64;
 
     std::mutex mutex_;      // mutex for inter-thread communication
     std::vector<Functor> pendingFunctors_;  // queue for async tasks
     // do I need to support args forwording?
+
+    std::unique_ptr<SlabAllocator> connectionSlab_;
+    std::unique_ptr<TimerQueue> timerQueue_;
 };
 
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <string_view>
+#include <cstddef>
+
+struct HttpHeader {
+    std::string_view name;
+    std::string_view value;
+};
+
+// a parsed request, every field is a view into the connection's input buffer
+// valid until the request's bytes are retrieved from that buffer
+class HttpRequest {
+public:
+    static constexpr size_t kMaxHeaders = 64;
+
+    std::string_view method;
+    std::string_view target;    // path with query
+    std::string_view path;
+    std::string_view query;     // without '?'
+    int versionMinor = 1;       // HTTP/1.x
+    HttpHeader headers[kMaxHeaders];
+    size_t headerCount = 0;
+    std::string_view body;
+    bool keepAlive = true;
+
+    // case-insensitive lookup, empty view if missing
+    std::string_view header(std::string_view name) const;
+};
+
+/**
+ * incremental, allocation-free HTTP/1.x request parser
+ * keeps only offsets between calls ( the buffer may move when it grows ),
+ * so a slowly arriving header is never rescanned from the start
+ * one parser per connection, reset() after each complete request
+ */
+class HttpParser {
+public:
+    enum class Result { COMPLETE, INCOMPLETE, ERROR };
+
+    static constexpr size_t kMaxHeaderBytes = 64 * 1024;
+
+    explicit HttpParser(size_t maxBodyBytes = 8 * 1024 * 1024) : maxBodyBytes_(maxBodyBytes) {}
+
+    // data: unconsumed bytes, always starting at the current request
+    // on COMPLETE, req is filled and consumed() bytes belong to it
+    Result parse(const char *data, size_t len, HttpRequest *req);
+
+    size_t consumed() const { return headerLen_ + contentLength_; }
+    void reset() { scanned_ = 0; headerLen_ = 0; contentLength_ = 0; }
+
+private:
+    // parse request line and headers of [data, data + headerLen_)
+    bool parseHead(const char *data, HttpRequest *req);
+
+    size_t maxBodyBytes_;
+    size_t scanned_ = 0;        // prefix already searched for the end of header
+    size_t headerLen_ = 0;      // including the blank line, 0 until found
+    size_t contentLength_ = 0;
+};
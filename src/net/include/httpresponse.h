@@ -0,0 +1,51 @@
+#pragma once
+
+#include "callback.h"
+
+#include <string>
+#include <string_view>
+
+/**
+ * response builder, serialized straight into an output buffer
+ * strings keep their capacity across clear(), so a reused response
+ * stops allocating once warmed up
+ */
+class HttpResponse {
+public:
+    HttpResponse() { clear(); }
+
+    void setStatus(int code, std::string_view reason) { statusCode_ = code; reason_ = reason; }
+    void setContentType(std::string_view type) { addHeader("Content-Type", type); }
+    void addHeader(std::string_view name, std::string_view value) {
+        headers_.append(name.data(), name.size());
+        headers_.append(": ", 2);
+        headers_.append(value.data(), value.size());
+        headers_.append("\r\n", 2);
+    }
+    void setBody(std::string_view body) { body_.assign(body.data(), body.size()); }
+    void appendBody(std::string_view body) { body_.append(body.data(), body.size()); }
+
+    void setCloseConnection(bool on) { closeConnection_ = on; }
+    bool closeConnection() const { return closeConnection_; }
+    // HTTP/1.0 clients only keep the connection if the response says so
+    void setVersionMinor(int minor) { versionMinor_ = minor; }
+
+    void clear() {
+        statusCode_ = 200;
+        reason_ = "OK";
+        headers_.clear();
+        body_.clear();
+        closeConnection_ = false;
+        versionMinor_ = 1;
+    }
+
+    void appendToBuffer(Buffer *out) const;
+
+private:
+    int statusCode_;
+    std::string_view reason_;   // expected to be a literal
+    std::string headers_;
+    std::string body_;
+    bool closeConnection_;
+    int versionMinor_;
+};
@@ -0,0 +1,39 @@
+#pragma once
+
+#include "noncopyable.h"
+#include "tcpserver.h"
+#include "httpparser.h"
+#include "httpresponse.h"
+
+#include <functional>
+
+/**
+ * HTTP/1.1 on top of TcpServer
+ * - requests are parsed in place, handlers see views into the input buffer
+ * - keep-alive by default for 1.1, opt-in for 1.0
+ * - pipelining: every complete request of a read event is handled in order,
+ *   and all their responses go out in a single send
+ */
+class HttpServer : Noncopyable {
+public:
+    using HttpCallback = std::function<void(const HttpRequest&, HttpResponse*)>;
+
+    HttpServer(const char *ip, int port, int thread_num = std::thread::hardware_concurrency());
+    explicit HttpServer(const InetAddress &listenAddr, int thread_num = std::thread::hardware_concurrency());
+
+    void setHttpCallback(const HttpCallback &cb) { httpCallback_ = cb; }
+    void setMaxBodyBytes(size_t bytes) { maxBodyBytes_ = bytes; }
+
+    TcpServer& tcpServer() { return server_; }
+
+    void start() { server_.start(); }
+    void stop() { server_.stop(); }
+
+private:
+    void onConnection(const TcpConnectionPtr &conn);
+    void onMessage(const TcpConnectionPtr &conn, Buffer *buf, TimeStamp receiveTime);
+
+    TcpServer server_;
+    HttpCallback httpCallback_;
+    size_t maxBodyBytes_ = 8 * 1024 * 1024;
+};
@@ -1,42 +1,103 @@
 #pragma once
 
 #include <string>
+#include <cstdio>
+#include <cstring>
+#include <cstddef>
+#include <algorithm>
+#include <system_error>
+#include <cerrno>
 #include <arpa/inet.h>
 #include <netinet/in.h>
+#include <sys/un.h>
 
+/**
+ * socket address, AF_INET or AF_UNIX
+ * unix paths starting with '@' live in the abstract namespace ( leading nul byte,
+ * no file on disk, gone with the last socket )
+ */
 class InetAddress{
 public:
 
     explicit InetAddress(uint16_t port = 0){
-        addr_.sin_family = AF_INET;
-        addr_.sin_port = ::htons(port);
-        addr_.sin_addr.s_addr = ::htonl(INADDR_ANY);
+        addr_.in.sin_family = AF_INET;
+        addr_.in.sin_port = ::htons(port);
+        addr_.in.sin_addr.s_addr = ::htonl(INADDR_ANY);
+        len_ = sizeof(sockaddr_in);
     }
     explicit InetAddress(std::string ip, uint16_t port = 0){
-        addr_.sin_family = AF_INET;
-        addr_.sin_port = ::htons(port);
-        addr_.sin_addr.s_addr = ::inet_addr(ip.c_str());
+        addr_.in.sin_family = AF_INET;
+        addr_.in.sin_port = ::htons(port);
+        addr_.in.sin_addr.s_addr = ::inet_addr(ip.c_str());
+        len_ = sizeof(sockaddr_in);
     }
+
+    // "/run/app.sock" or "@app" for the abstract namespace
+    // throws ENAMETOOLONG past sun_path ( 107 bytes for a file, 108 with the '@' )
+    // rather than silently binding a truncated name
+    static InetAddress fromUnixPath(const std::string &path){
+        InetAddress addr;
+        std::memset(&addr.addr_, 0, sizeof(addr.addr_));
+        addr.addr_.un.sun_family = AF_UNIX;
+        bool abstract = !path.empty() && path[0] == '@';
+        size_t n = path.size();
+        if (n > sizeof(addr.addr_.un.sun_path) - (abstract ? 0 : 1)) {
+            throw std::system_error(ENAMETOOLONG, std::system_category(), "unix socket path too long: " + path);
+        }
+        std::memcpy(addr.addr_.un.sun_path, path.data(), n);
+        if (abstract) addr.addr_.un.sun_path[0] = '\0';
+        // abstract names are not nul-terminated, the length delimits them
+        addr.len_ = static_cast<socklen_t>(offsetof(sockaddr_un, sun_path) + n + (abstract ? 0 : 1));
+        return addr;
+    }
+
+    sa_family_t family() const { return addr_.sa.sa_family; }
+    bool isUnix() const { return family() == AF_UNIX; }
+
     uint16_t toPort() const {
-        return ::ntohs(addr_.sin_port);
+        return isUnix() ? 0 : ::ntohs(addr_.in.sin_port);
     }
 
+    // unix: the path, "@name" for abstract, "unix" for an unnamed peer
     std::string toIp() const{
-        thread_local static char buf[32] = {};
-        ::inet_ntop(AF_INET, &addr_.sin_addr, buf, sizeof(buf));
+        if (isUnix()) return unixPath();
+        char buf[INET_ADDRSTRLEN] = {};
+        ::inet_ntop(AF_INET, &addr_.in.sin_addr, buf, sizeof(buf));
         return buf;
     }
     std::string toIpPort() const{
-        thread_local static char buf[64] = {};
-        ::inet_ntop(AF_INET, &addr_.sin_addr, buf, sizeof(buf) );
-        uint16_t port = ::ntohs(addr_.sin_port);
-        sprintf(buf + 32, ": %u", port);
+        if (isUnix()) return unixPath();
+        char buf[INET_ADDRSTRLEN + 8] = {};
+        ::inet_ntop(AF_INET, &addr_.in.sin_addr, buf, sizeof(buf));
+        size_t n = std::strlen(buf);
+        snprintf(buf + n, sizeof(buf) - n, ":%u", static_cast<unsigned>(::ntohs(addr_.in.sin_port)));
         return buf;
     }
-    void setSockAddr(const sockaddr_in addr) { addr_ = addr; }
-    const sockaddr_in *getSockAddr() const { return &addr_; }
 
+    void setSockAddr(const sockaddr_in addr) { addr_.in = addr; len_ = sizeof(addr); }
+    void setSockAddr(const sockaddr *addr, socklen_t len) {
+        len = std::min<socklen_t>(len, sizeof(addr_));
+        std::memcpy(&addr_, addr, len);
+        len_ = len;
+    }
+    const sockaddr *getSockAddr() const { return &addr_.sa; }
+    socklen_t getSockLen() const { return len_; }
+
+    // large enough for any family we accept
+    static constexpr socklen_t kMaxSockLen = sizeof(sockaddr_un);
 
 private:
-    sockaddr_in addr_{};  // address family, port and address(32 bits), and padding to 15 bytes
-};
\ No newline at end of file
+    std::string unixPath() const {
+        size_t pathLen = len_ > offsetof(sockaddr_un, sun_path) ? len_ - offsetof(sockaddr_un, sun_path) : 0;
+        if (pathLen == 0) return "unix";
+        if (addr_.un.sun_path[0] == '\0') return "@" + std::string(addr_.un.sun_path + 1, pathLen - 1);
+        return std::string(addr_.un.sun_path, strnlen(addr_.un.sun_path, pathLen));
+    }
+
+    union {
+        sockaddr sa;
+        sockaddr_in in;     // address family, port and address(32 bits), and padding to 15 bytes
+        sockaddr_un un;
+    } addr_{};
+    socklen_t len_ = sizeof(sockaddr_in);
+};
@@ -0,0 +1,59 @@
+#pragma once
+
+#include "callback.h"
+#include "timestamp.h"
+
+#include <functional>
+#include <string_view>
+#include <cstdint>
+#include <cstddef>
+
+enum class LengthEncoding { FIXED_BIG_ENDIAN, FIXED_LITTLE_ENDIAN, VARINT };
+
+/**
+ * length-prefixed framing between TcpConnection::handleRead and user code
+ *
+ * inbound:  every complete frame in a read batch is handed out as a view into
+ *           the connection's input buffer, no copy. a partial frame stays buffered,
+ *           and the next read is sized to what is still missing
+ * outbound: the length goes into the payload buffer's prependable space
+ *
+ * stateless ( partial data lives in the connection's buffer ),
+ * so one codec can serve every connection of a server
+ */
+class LengthCodec {
+public:
+    // frame is only valid during the call
+    using FrameCallback = std::function<void(const TcpConnectionPtr&, std::string_view, TimeStamp)>;
+
+    // width: 1, 2, 4 or 8 bytes for fixed encodings, ignored for varint
+    LengthCodec(LengthEncoding encoding, int width, size_t maxFrameSize, FrameCallback cb);
+
+    // install with conn->setMessageCallback(codec.messageCallback())
+    MessageCallback messageCallback() const {
+        return [this](const TcpConnectionPtr &conn, Buffer *buf, TimeStamp ts){ onMessage(conn, buf, ts); };
+    }
+    void onMessage(const TcpConnectionPtr &conn, Buffer *buf, TimeStamp ts) const;
+
+    // prepend the length of payload's readable bytes in place
+    // false ( payload untouched ) if the length does not fit the header width or
+    // exceeds maxFrameSize, the peer would desync or drop the connection
+    bool encode(Buffer *payload) const;
+    // encode and send, payload is consumed, false and nothing sent if encode refused
+    bool send(const TcpConnectionPtr &conn, Buffer *payload) const;
+
+    // bytes to reserve up front ( Buffer::reservePrepend ) so encode never shifts
+    size_t maxHeaderSize() const { return encoding_ == LengthEncoding::VARINT ? kMaxVarintBytes : width_; }
+
+private:
+    static constexpr size_t kMaxVarintBytes = 10;
+
+    enum class ParseResult { OK, NEED_MORE, ERROR };
+    // decode the header at data, on OK fill header size and frame length
+    ParseResult parseHeader(const char *data, size_t readable, size_t *headerLen, uint64_t *frameLen) const;
+
+    LengthEncoding encoding_;
+    size_t width_;
+    size_t maxFrameSize_;
+    FrameCallback frameCallback_;
+};
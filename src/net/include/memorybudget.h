@@ -0,0 +1,33 @@
+#pragma once
+
+#include "noncopyable.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * server-wide byte budget shared by all connections across io loops
+ * each connection charges the delta of what it holds, so the counter is
+ * the sum over connections without any lock
+ * limit == 0 means unlimited ( just accounting )
+ */
+class MemoryBudget : Noncopyable {
+public:
+    explicit MemoryBudget(size_t limit = 0) : limit_(limit) {}
+
+    void setLimit(size_t limit) { limit_.store(limit, std::memory_order_relaxed); }
+    size_t limit() const { return limit_.load(std::memory_order_relaxed); }
+
+    void charge(int64_t delta) { used_.fetch_add(delta, std::memory_order_relaxed); }
+    int64_t used() const { return used_.load(std::memory_order_relaxed); }
+
+    bool exceeded() const {
+        size_t lim = limit();
+        return lim != 0 && used() > static_cast<int64_t>(lim);
+    }
+
+private:
+    std::atomic<size_t> limit_;
+    std::atomic<int64_t> used_{0};
+};
@@ -0,0 +1,64 @@
+#pragma once
+
+#include "noncopyable.h"
+#include "tokenbucket.h"
+
+#include <string>
+#include <memory>
+#include <unordered_map>
+
+// bytes per second on one direction of a socket, 0 = unlimited
+// burst 0 allows one second worth
+struct RateLimit {
+    double bytesPerSecond = 0;
+    double burstBytes = 0;
+    bool limited() const { return bytesPerSecond > 0; }
+};
+
+class PeerRateTable;
+
+// buckets shared by every connection from one client address on one loop
+struct SharedRateBuckets {
+    TokenBucket read;
+    TokenBucket write;
+    PeerRateTable *table = nullptr;
+    std::string key;
+    size_t refs = 0;
+};
+
+/**
+ * client address -> shared buckets, one table per io loop and only touched
+ * on that loop's thread, so no lock anywhere on the data path
+ * an entry lives as long as some connection from that address does
+ */
+class PeerRateTable : Noncopyable {
+public:
+    PeerRateTable(const RateLimit &read, const RateLimit &write) : read_(read), write_(write) {}
+
+    SharedRateBuckets* acquire(const std::string &key, int64_t nowMicros) {
+        auto &entry = peers_[key];
+        if (!entry) {
+            entry = std::make_unique<SharedRateBuckets>();
+            entry->read.reset(read_.bytesPerSecond, read_.burstBytes, nowMicros);
+            entry->write.reset(write_.bytesPerSecond, write_.burstBytes, nowMicros);
+            entry->table = this;
+            entry->key = key;
+        }
+        ++entry->refs;
+        return entry.get();
+    }
+
+    void release(SharedRateBuckets *entry) {
+        if (--entry->refs == 0) {
+            std::string key = std::move(entry->key);   // erase destroys entry
+            peers_.erase(key);
+        }
+    }
+
+    size_t size() const { return peers_.size(); }
+
+private:
+    RateLimit read_;
+    RateLimit write_;
+    std::unordered_map<std::string, std::unique_ptr<SharedRateBuckets>> peers_;
+};
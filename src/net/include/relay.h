@@ -0,0 +1,61 @@
+#pragma once
+
+#include "noncopyable.h"
+#include "callback.h"
+#include "ref_counted.h"
+
+#include <cstddef>
+
+class EventLoop;
+
+/**
+ * L4 relay between two connections of the same loop, bytes move socket -> pipe -> socket
+ * with splice(2) and never enter user space
+ * each direction has its own pipe; backpressure is plain channel interest:
+ * a full pipe stops reading the source and waits for the sink to become writable
+ * a FIN is passed on as a half-close once its pipe drained, both ends are closed
+ * when both directions finished, or at once when either side fails
+ *
+ * whatever already sits in a connection's input buffer ( e.g. bytes read while picking
+ * the upstream ) is forwarded first, through the normal send path
+ */
+class Relay : Noncopyable {
+public:
+    // on the loop both connections belong to; the relay frees itself when done
+    static bool start(const TcpConnectionPtr &a, const TcpConnectionPtr &b);
+
+    // TcpConnection hands its events over while attached
+    void onReadable(TcpConnection *conn);
+    void onWritable(TcpConnection *conn);
+    void onClose(TcpConnection *conn);
+
+    static size_t bytesRelayed();
+
+private:
+    struct Direction {
+        TcpConnection *from = nullptr;
+        TcpConnection *to = nullptr;
+        int pipe[2] = { -1, -1 };
+        size_t inPipe = 0;      // bytes spliced in, not yet out
+        bool eof = false;       // source sent FIN
+        bool done = false;      // FIN passed on
+    };
+
+    Relay(const TcpConnectionPtr &a, const TcpConnectionPtr &b);
+    ~Relay();
+
+    bool init();
+    // move as much as possible from -> pipe -> to, then set interest accordingly
+    void pump(Direction &d);
+    void fail(const char *what);
+    void finishIfDone();
+    void detach(TcpConnection *conn);
+
+    EventLoop *loop_;
+    TcpConnectionPtr a_;        // both ends stay alive while the relay runs
+    TcpConnectionPtr b_;
+    Direction dirs_[2];         // a -> b, b -> a
+    size_t pipeCapacity_ = 0;
+    int attached_ = 0;
+    bool closing_ = false;
+};
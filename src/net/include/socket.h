@@ -6,6 +6,8 @@
 #include <netinet/tcp.h>
 #include "unistd.h"
 #include "logger.h"
+#include <cerrno>
+#include <cstring>
 
 class InetAddress;
 
@@ -17,11 +19,11 @@ public:
         ::close(sockfd_);
     }
 
-    int fd() { return sockfd_; }
+    int fd() const { return sockfd_; }
 
     // socket standard operations
     void bindAddress(const InetAddress &localAddr){
-        if(::bind(sockfd_, (sockaddr *)localAddr.getSockAddr(), sizeof(sockaddr_in))){
+        if(::bind(sockfd_, localAddr.getSockAddr(), localAddr.getSockLen())){
             LOG_FATAL << "bind sockfd :" << sockfd_ << " failed";
         }
     }
@@ -33,14 +35,18 @@ public:
 
     // retrieve client address from the other end
     int accept(InetAddress *peerAddr){
-        sockaddr_in clientAddr{};
+        // inet or unix, whatever the listen socket is
+        sockaddr_storage clientAddr{};
         socklen_t addrLen = sizeof(clientAddr);
 
         int connFd = ::accept4(sockfd_, (sockaddr*)&clientAddr, &addrLen, SOCK_NONBLOCK | SOCK_CLOEXEC);
         if(connFd >= 0){
-            peerAddr->setSockAddr(clientAddr);
-        }else{
-            LOG_ERROR << "accept4() failed";
+            peerAddr->setSockAddr((sockaddr*)&clientAddr, addrLen);
+        }else if(errno != EAGAIN && errno != EWOULDBLOCK){
+            // EMFILE & co. repeat on every readable event, keep the loop from drowning in logs
+            int savedErrno = errno;     // the caller decides what to do with it
+            LOG_EVERY_T(LogLevel::ERROR, 1.0) << "accept4() failed: " << strerror(savedErrno);
+            errno = savedErrno;
         }
         return connFd;
     }
@@ -48,7 +54,7 @@ public:
     // socket options
     void shutdownWrite(){
         if(::shutdown(sockfd_, SHUT_WR) < 0){
-            LOG_ERROR << "shutdownWrite() failed";
+            LOG_EVERY_T(LogLevel::ERROR, 1.0) << "shutdownWrite() failed: " << strerror(errno);
         }
     }
 
@@ -69,6 +75,26 @@ public:
         ::setsockopt(sockfd_, SOL_SOCKET, SO_REUSEPORT, &optval, sizeof(optval));
     }
     
+    // listen socket: wake accept only once the first data segment arrived,
+    // the handshake alone does not produce a connection ( seconds bounds the wait )
+    bool setDeferAccept(int seconds){
+        if(::setsockopt(sockfd_, IPPROTO_TCP, TCP_DEFER_ACCEPT, &seconds, sizeof(seconds)) < 0){
+            LOG_ERROR << "setsockopt TCP_DEFER_ACCEPT failed: " << strerror(errno);
+            return false;
+        }
+        return true;
+    }
+
+    // listen socket: accept data in the SYN from clients holding a cookie,
+    // queueLen caps pending fast open requests, needs net.ipv4.tcp_fastopen & 2
+    bool setFastOpen(int queueLen){
+        if(::setsockopt(sockfd_, IPPROTO_TCP, TCP_FASTOPEN, &queueLen, sizeof(queueLen)) < 0){
+            LOG_ERROR << "setsockopt TCP_FASTOPEN failed: " << strerror(errno);
+            return false;
+        }
+        return true;
+    }
+
     // every 2 hour send a keep-alive packet
     void setKeepAlive(bool on){
         int optval = on;
@@ -0,0 +1,53 @@
+#pragma once
+
+#include "noncopyable.h"
+#include "connector.h"
+#include "tcpconnection.h"
+#include "callback.h"
+
+#include <memory>
+#include <string>
+
+/**
+ * one outgoing connection on a given loop, same TcpConnection as the server side
+ * reconnects with backoff when enableRetry() is set and the connection drops
+ * construct, connect and destroy on the loop thread
+ */
+class TcpClient : Noncopyable {
+public:
+    TcpClient(EventLoop *loop, const InetAddress &serverAddr, const std::string &name);
+    ~TcpClient();
+
+    void connect();
+    // half-close once pending output is written
+    void disconnect();
+    // stop connecting ( a live connection is left alone )
+    void stop();
+
+    void enableRetry() { retry_ = true; }
+    void setRetryDelay(double initialSeconds, double maxSeconds) { connector_->setRetryDelay(initialSeconds, maxSeconds); }
+
+    EventLoop* getLoop() const { return loop_; }
+    // null while not connected
+    const TcpConnectionPtr& connection() const { return connection_; }
+
+    void setConnectionCallback(ConnectionCallback cb) { connectionCallback_ = std::move(cb); }
+    void setMessageCallback(MessageCallback cb) { messageCallback_ = std::move(cb); }
+    void setWriteCompleteCallback(WriteCompleteCallback cb) { writeCompleteCallback_ = std::move(cb); }
+
+private:
+    void newConnection(int sockfd);
+    void removeConnection(const TcpConnectionPtr &conn);
+
+    EventLoop *loop_;
+    std::unique_ptr<Connector> connector_;
+    const std::string name_;
+    bool retry_ = false;
+    bool connect_ = false;
+    uint64_t nextConnId_ = 0;
+    TcpConnectionPtr connection_;
+
+    ConnectionCallback connectionCallback_;
+    MessageCallback messageCallback_;
+    WriteCompleteCallback writeCompleteCallback_;
+};
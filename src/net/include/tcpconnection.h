@@ -3,67 +3,180 @@
 #include <memory>
 #include <functional>
 #include <any>
+#include <algorithm>
+#include <cstdint>
 #include "eventloop.h"
 #include "socket.h"
+#include "channel.h"
 #include "timestamp.h"
 #include "callback.h"
+#include "ref_counted.h"
+#include "memorybudget.h"
+#include "ratelimit.h"
 #include "buffer/singletonBufferPool.h"
 
+class Relay;
+
 // owns a TCP socket, which is polled by an eventloop in a channel
-// Created by server after accept()
-class TcpConnection : Noncopyable,  public std::enable_shared_from_this<TcpConnection> {
+// Created by server after accept(), carved from the loop's slab
+// Socket and Channel are embedded, the whole connection is one slab slot
+// lifetime: intrusive non-atomic refcount, every ref is taken on the loop thread
+class TcpConnection : Noncopyable, public RefCounted<TcpConnection> {
 public:
-    
-    TcpConnection(int fd, EventLoop* loop, const std::string &name,const InetAddress &localAddr,const InetAddress &clientAddr);
-    ~TcpConnection();
+    // weak reference, safe to copy across threads and to keep in timers
+    // lock() only on the owner loop thread, it fails once the slot is freed or reused
+    class Handle {
+    public:
+        Handle() = default;
+        Handle(TcpConnection *conn, uint32_t gen) : conn_(conn), generation_(gen) {}
+        TcpConnectionPtr lock() const {
+            return SlabAllocator::alive(conn_, generation_) ? TcpConnectionPtr(conn_) : TcpConnectionPtr();
+        }
+    private:
+        TcpConnection *conn_ = nullptr;
+        uint32_t generation_ = 0;
+    };
+
+    // must be called on loop's thread
+    static TcpConnectionPtr create(EventLoop* loop, int fd, const std::string &name, const InetAddress &localAddr, const InetAddress &clientAddr);
 
     EventLoop* getLoop() const { return loop_; }     // loop is owned by threadpool actually
-    const std::string& name() const { return name_; }
+    const char* name() const { return name_; }
     const InetAddress& localAddr() const { return localAddr_; }
     const InetAddress& clientAddr() const { return clientAddr_; }
+    Handle handle() const { return Handle(const_cast<TcpConnection*>(this), SlabAllocator::generation(this)); }
 
     bool connected() const { return state_ == State::CONNECTED; }
 
     void setConnectionCallback(const ConnectionCallback &cb) { connectionCallback_ = cb; }
+    void setMessageCallback(const MessageCallback& cb) { messageCallback_ = cb; }
     void setReadDataCallback(const ReadDataCallback& cb) { readDataCallback_ = cb; }
     void setCloseCallback(const CloseCallback& cb) { closeCallback_ = cb; }
     void setWriteCompleteCallback(const WriteCompleteCallback &cb) { writeCompleteCallback_ = cb; }
+    // fired once each time pending output crosses highWaterMark upwards
+    void setHighWaterMarkCallback(const HighWatermarkCallback &cb) { highWaterMarkCallback_ = cb; }
+
+    // backpressure: reading pauses when pending output reaches high,
+    // and resumes once it drains to low ( or below )
+    void setWaterMarks(size_t high, size_t low) { highWaterMark_ = high; lowWaterMark_ = low; }
+    size_t highWaterMark() const { return highWaterMark_; }
+    size_t lowWaterMark() const { return lowWaterMark_; }
+    // shared server-wide budget on output bytes, must outlive the connection
+    void setOutputBudget(MemoryBudget *budget) { outputBudget_ = budget; }
+    bool readPaused() const { return readPaused_; }
+
+    // token-bucket limits on socket reads and writes, set on the loop thread
+    // an empty bucket stops reading ( or writing ) until a loop timer sees it refilled,
+    // nothing is buffered beyond what the socket already holds
+    // relayed connections splice past the limits
+    void setRateLimits(const RateLimit &read, const RateLimit &write);
+    // buckets shared with the other connections from the same client, drawn on top of
+    // our own, released when the connection goes away
+    void setPeerRateBuckets(SharedRateBuckets *peer) { peerBuckets_ = peer; }
+    bool rateThrottled() const { return readThrottled_ || writeThrottled_; }
+
+    // buffer memory reclamation: both buffers start in their inline bytes and only lease
+    // storage from BufferMemoryPool for bigger data, a buffer that emptied while holding
+    // more than keepBytes goes back inline right away ( after a burst ), and with
+    // idleSeconds > 0 whatever is left does once the connection was quiet that long
+    // the pool keeps returned storage for the next connection until its trim
+    void setBufferReclaim(size_t keepBytes, double idleSeconds);
+    // leased bytes of both buffers are summed into this, must outlive the connection
+    void setBufferMemory(MemoryBudget *memory) { bufferMemory_ = memory; }
+    size_t bufferHeapBytes() const { return inputBuffer_.heapBytes() + outputBuffer_.heapBytes(); }
+    size_t pendingOutputBytes() const { return outputBuffer_.readableBytes(); }
 
     // add the connection fd to epoll fd list
-    void establishConnection();
+    // readNow: read what already arrived ( deferred accept, fast open ) without an epoll round
+    void establishConnection(bool readNow = false);
     // remove the connection fd from epoll fd set
     void destroyConnection();
     // shutdown the write end of the socket
     void shutdown();
+    // close now, dropping pending output ( e.g. protocol violation )
+    void forceClose();
+
+    // make the next read able to take at least `bytes` in one go,
+    // codecs use it when they know how much of a frame is still missing
+    void setReadSizeHint(size_t bytes) { readSizeHint_ = bytes; }
+
+    // throughput knob for bulk connections: up to `reads` read calls and `bytes` bytes per
+    // readable event, growing inputBuffer_ as needed, fewer wakeups and callbacks per MB
+    // it costs latency to everything else on the loop ( bench/read_fairness.cpp ),
+    // the default, one read of whatever room inputBuffer_ has, is the fair setting
+    // unread data keeps the ( level-triggered ) fd ready, so it is picked up next iteration
+    void setReadBatch(size_t bytes, int reads) { readBatchBytes_ = bytes; readBatchReads_ = std::max(reads, 1); }
 
+    // thread-safe, data is copied when called off the loop thread
     void send(const std::string &str);
     void send(const Buffer &buf);
+    void send(const char *data, size_t len);
     
 
-    int fd() const { return socket_->fd(); };
+    int fd() const { return socket_.fd(); };
     void setContext(const std::any &context) { context_ = context; }
     const std::any& getContext() const { return context_; }
+    std::any* getMutableContext() { return &context_; }
 
 
 private:
+    friend class RefCounted<TcpConnection>;
+    friend class Relay;     // drives the socket and channel directly while attached
+    friend class EventLoop; // closes what is left when it goes away
+    TcpConnection(int fd, EventLoop* loop, const std::string &name,const InetAddress &localAddr,const InetAddress &clientAddr);
+    ~TcpConnection();
+    // last ref dropped: destruct in place and give the slot back to the loop's slab
+    void destroy();
+    // drop the ref the loop holds while the channel is registered
+    void unregister();
+
     // functions defined in tcp-conn is passed to channel
     void handleRead(TimeStamp receiveTime);
     void handleWrite();
     void handleClose();
     void handleError();
 
+    void sendInLoop(const char *data, size_t len);
+    void shutdownInLoop();
+    // re-evaluate watermarks and the server budget after outputBuffer_ changed
+    void updateBackpressure();
+
+    // bytes the rate limits let through now, SIZE_MAX when unlimited
+    size_t rateAllowance(bool read, int64_t now);
+    void chargeRate(bool read, size_t bytes, int64_t now);
+    bool readLimited() const { return readBucket_.limited() || (peerBuckets_ && peerBuckets_->read.limited()); }
+    bool writeLimited() const { return writeBucket_.limited() || (peerBuckets_ && peerBuckets_->write.limited()); }
+    // out of tokens: stop polling that direction, a timer turns it back on
+    void throttle(bool read, int64_t now);
+    void resumeRead();
+    void resumeWrite();
+
+    // after reads and writes: stamp activity, account capacity, arm the idle reclaim
+    void noteBufferUse();
+    void updateBufferMemory();
+    void reclaimIdleBuffers();
+
     // eventloop management
 
     
     enum class State { DISCONNECTED, CONNECTED, CONNECTING, DISCONNECTING };
-    void *setState(State state) {state_ = state;}
+    void setState(State state) {state_ = state;}
 
     
+    static constexpr size_t kMaxNameLen = 64;
+    // a throttled direction waits for this many tokens ( or a full burst ), not for one byte
+    static constexpr double kRateQuantum = 4096;
+    // growth step for the extra reads of a batched event
+    static constexpr size_t kReadChunk = 64 * 1024;
+    // per buffer, enough for heartbeats, acks and most small requests
+    static constexpr size_t kInlineBufferBytes = 128;
+
     EventLoop* loop_;
-    std::unique_ptr<Socket> socket_;    // connection socket
-    std::unique_ptr<Channel> channel_;
+    Socket socket_;     // connection socket, closed in destructor
+    Channel channel_;
+    bool registered_;   // loop holds a ref from establishConnection to close
 
-    const std::string name_;
+    char name_[kMaxNameLen];    // inline, no separate heap allocation
 
     const InetAddress localAddr_;
     const InetAddress clientAddr_;
@@ -72,7 +185,9 @@ private:
 
     // called after connection established/destoryed    ( connection establish using connfd as an async procedure )
     ConnectionCallback connectionCallback_;
-    // called after reading data
+    // called after reading data, zero-copy view into inputBuffer_
+    MessageCallback messageCallback_;
+    // legacy variant, used only if no message callback is set
     ReadDataCallback readDataCallback_;
     // async structure, to eventloop thread
     // after data copied from user buffer to kernel buffer, do something
@@ -83,9 +198,31 @@ private:
     // high watermark
     HighWatermarkCallback highWaterMarkCallback_;
     size_t highWaterMark_;
-
-    Buffer inputBuffer_;
-    Buffer outputBuffer_;
+    size_t lowWaterMark_;
+    bool readPaused_;           // reading disabled by backpressure, not by the user
+    MemoryBudget *outputBudget_;
+    size_t chargedBytes_;       // what we currently account for in outputBudget_
+
+    TokenBucket readBucket_;
+    TokenBucket writeBucket_;
+    SharedRateBuckets *peerBuckets_ = nullptr;
+    bool readThrottled_ = false;
+    bool writeThrottled_ = false;
+
+    size_t reclaimKeepBytes_ = SIZE_MAX;
+    int64_t reclaimIdleMicros_ = 0;     // 0: no idle reclaim
+    int64_t lastActive_ = 0;            // steady micros of the last read or write
+    bool reclaimArmed_ = false;
+    MemoryBudget *bufferMemory_ = nullptr;
+    size_t bufferCharged_ = 0;
+
+    buffer_internal::InlineBuffer<kInlineBufferBytes> inputBuffer_;
+    buffer_internal::InlineBuffer<kInlineBufferBytes> outputBuffer_;
+    size_t readSizeHint_;
+    size_t readBatchBytes_ = 0;     // 0: no byte cap beyond the buffer room
+    int readBatchReads_ = 1;
+
+    Relay *relay_ = nullptr;    // spliced to another connection, reads and writes go through it
 
     std::any context_;      // just like void* type context in c 
 };
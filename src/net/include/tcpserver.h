@@ -7,32 +7,156 @@
 #include <functional>
 #include "eventloop.h"
 #include "tcpconnection.h"
+#include "socket.h"
+#include "channel.h"
 #include "timer.h"
 #include "threadpool.h"
+#include "upgrade.h"
+#include "tokenbucket.h"
+
+#include <string>
 
 class TcpServer {
 public:
+    /**
+     * admission control on the accept path, every limit is off at 0
+     * a connection over a limit is shed: accepted and closed at once, or with
+     * pauseAccept left in the kernel backlog while the listen socket is not read
+     */
+    struct OverloadOptions {
+        size_t maxConnections = 0;
+        int64_t maxLoopLagMicros = 0;   // shed when every io loop lags more than this
+        double acceptRate = 0;          // accepts per second
+        double acceptBurst = 0;         // 0 = one second worth of acceptRate
+        int fdHeadroom = 32;            // fds kept free below RLIMIT_NOFILE
+        bool pauseAccept = false;
+        double pauseSeconds = 0.05;
+    };
+
+    // shed counters by reason, written on the accept thread, read anywhere
+    // with pauseAccept they count the pauses each reason caused
+    struct AcceptStats {
+        std::atomic<uint64_t> accepted{0};
+        std::atomic<uint64_t> shedConnectionLimit{0};
+        std::atomic<uint64_t> shedLag{0};
+        std::atomic<uint64_t> shedRate{0};
+        std::atomic<uint64_t> shedFds{0};
+        std::atomic<uint64_t> emfile{0};        // accept failed for lack of fds, reserve fd used
+        std::atomic<uint64_t> pauses{0};
+    };
+
     TcpServer(const char* ip, int port, int thread_num = std::thread::hardware_concurrency());
+    // any stream address, e.g. InetAddress::fromUnixPath("@app") for same-host clients
+    explicit TcpServer(const InetAddress &listen_addr, int thread_num = std::thread::hardware_concurrency());
     ~TcpServer();
     
     void start();
     void stop();
     
-    void set_connection_callback(std::function<void(std::shared_ptr<TcpConnection>)> cb);
-    void set_message_callback(typename TcpConnection::DataCallback cb);
+    void set_connection_callback(ConnectionCallback cb);
+    void set_message_callback(MessageCallback cb);
+    // legacy shared_ptr<Buffer> variant, costs a copy per read
+    void set_read_data_callback(ReadDataCallback cb);
+    void set_write_complete_callback(WriteCompleteCallback cb);
+    void set_high_water_mark_callback(HighWatermarkCallback cb);
+
+    // per-connection backpressure, applied to connections accepted afterwards
+    void set_water_marks(size_t high, size_t low);
+    // cap on pending output summed over all connections, 0 = unlimited
+    void set_output_memory_budget(size_t bytes) { output_budget_.setLimit(bytes); }
+    int64_t output_memory_used() const { return output_budget_.used(); }
+
+    /**
+     * zero-downtime upgrade: exec argv ( e.g. {"/proc/self/exe", args...} ), hand it the
+     * listen fd over SCM_RIGHTS, and once it acks stop accepting and drain:
+     * start() returns when the last connection closed or the drain timeout passed
+     * the new process picks the fd up in its TcpServer constructor, nothing else to do
+     *
+     * any thread, never blocks: the ack is awaited on the accept loop, which keeps
+     * accepting meanwhile. returns false if the handoff could not even be sent ( or an
+     * upgrade is already underway ), otherwise done( took_over ) runs on the accept loop
+     * once the new process acked or failed to within 10s ( then we keep serving )
+     */
+    bool upgrade(const std::vector<std::string> &argv, std::function<void(bool)> done = nullptr);
+    void set_drain_timeout(int seconds) { drain_timeout_seconds_ = seconds; }
+    bool draining() const { return draining_; }
+    size_t connection_count() const { return connection_count_.load(std::memory_order_relaxed); }
+
+    /**
+     * handshake latency on the listen socket ( tcp only, call before start() )
+     * defer accept: no connection is set up until the client sent something, at most seconds
+     * fast open: data in the SYN is accepted, saving a round trip for returning clients
+     * with defer accept a new connection reads right away instead of waiting for epoll,
+     * the payload is there by construction
+     */
+    bool set_defer_accept(int seconds);
+    bool set_fast_open(int queue_len);
+
+    // idle memory: buffers emptied above keep_bytes are freed at once, the rest after
+    // idle_seconds without traffic ( 0 disables ), see TcpConnection::setBufferReclaim
+    void set_buffer_reclaim(size_t keep_bytes, double idle_seconds) { reclaim_keep_bytes_ = keep_bytes; reclaim_idle_seconds_ = idle_seconds; }
+    // pool bytes held by connection buffers right now ( inline bytes not counted ), all io loops together
+    int64_t buffer_memory_used() const { return buffer_memory_.used(); }
+
+    // read batching of each connection, a throughput knob, see TcpConnection::setReadBatch
+    // e.g. ( 256KB, 8 ) roughly tripled bulk echo throughput on one loop, and small
+    // requests sharing that loop waited ~15x longer at p99, leave it off for mixed traffic
+    void set_read_batch(size_t bytes, int reads) { read_batch_bytes_ = bytes; read_batch_reads_ = reads; }
+
+    // call before start()
+    void set_overload_options(const OverloadOptions &options);
+
+    // byte rate limits per connection, and per client ip summed over its connections
+    // with per-ip limits every connection of an ip goes to the same io loop ( hashed,
+    // instead of round robin ), whose bucket for that ip holds the full limit without
+    // locks ( call before start() )
+    void set_rate_limits(const RateLimit &read, const RateLimit &write);
+    void set_peer_rate_limits(const RateLimit &read, const RateLimit &write);
+    const AcceptStats& accept_stats() const { return accept_stats_; }
     
 private:
-    void handle_accept(int fd, uint32_t events);
-    void handle_close(std::shared_ptr<TcpConnection> conn);
+    enum class Shed { NONE, CONNECTIONS, LAG, RATE, FDS };
+    static constexpr int kMaxAcceptsPerEvent = 256;
+
+    void handle_accept(TimeStamp);
+    // whether the next connection may come in, checked before accepting it
+    Shed admit();
+    // round robin over the io loops that keep up, or by peer ip with per-ip rate limits
+    EventLoop* pick_loop(const InetAddress &peer_addr);
+    void shed(Shed reason);
+    void pause_accept(double seconds);
+    // EMFILE: free the reserve fd, accept and close one connection, take the reserve again
+    bool drop_with_reserve_fd();
+    // runs on the io loop the connection belongs to
+    void new_connection(EventLoop* loop, int conn_fd, const std::string &name, const InetAddress &peer_addr);
+    void handle_close(TcpConnectionPtr conn);
     void handle_timeout(int fd);
     EventLoop* get_next_loop();
+    // listen fd passed by the process we are upgrading from, or a fresh one
+    static int bind_or_inherit(const InetAddress &addr, int *upgrade_sock);
+    static void ignore_sigpipe();
+    void begin_drain();
+    // accept loop only: the new process acked ( or not, or timed out )
+    void finish_upgrade(bool took_over);
     
-    int listen_fd_;     // server socket
+    int upgrade_sock_ = -1;     // set when started by an upgrade, acked in start()
+    std::atomic<bool> upgrading_{false};
+    // accept loop only, while waiting for the new process to ack
+    std::unique_ptr<Channel> upgrade_channel_;
+    TimerId upgrade_timer_ = 0;
+    pid_t upgrade_pid_ = -1;
+    std::function<void(bool)> upgrade_done_;
+
+    // main loop only handle accept event, runs on the thread calling start()
     EventLoop main_loop_;
-    std::thread main_thread_;
+    Socket listen_socket_;      // server socket
+    Channel accept_channel_;
+    InetAddress listen_addr_;
     int io_thread_num_;
     std::atomic<int> next_loop_index_;
-    std::vector<std::unique_ptr<EventLoop>> loops_;
+    std::atomic<uint64_t> next_conn_id_;
+    // each io loop is constructed and owned by its worker thread, cleared once those joined
+    std::vector<EventLoop*> loops_;
 
     std::unique_ptr<ThreadPool> threadpool_;
     std::atomic<bool> running_{false};
@@ -40,6 +164,35 @@ private:
     ConnectionTimeoutManager timeout_manager_;
     std::thread timeout_thread_;
     
-    std::function<void(std::shared_ptr<TcpConnection>)> connection_callback_;
-    typename TcpConnection::DataCallback message_callback_;
+    ConnectionCallback connection_callback_;
+    MessageCallback message_callback_;
+    ReadDataCallback read_data_callback_;
+    WriteCompleteCallback write_complete_callback_;
+    HighWatermarkCallback high_water_mark_callback_;
+
+    size_t high_water_mark_ = 64 * 1024 * 1024;
+    size_t low_water_mark_ = 32 * 1024 * 1024;
+    MemoryBudget output_budget_;
+    MemoryBudget buffer_memory_;    // accounting only
+    size_t reclaim_keep_bytes_ = 64 * 1024;
+    double reclaim_idle_seconds_ = 30;
+
+    std::atomic<size_t> connection_count_{0};
+    std::atomic<bool> draining_{false};
+    int64_t drain_deadline_ = 0;    // steady micros, accept loop only
+    int drain_timeout_seconds_ = 30;
+
+    OverloadOptions overload_;
+    AcceptStats accept_stats_;
+    TokenBucket accept_bucket_;     // main loop only
+    int fd_limit_ = 0;              // accepted fds at or above this are shed, 0 = no check
+    int reserve_fd_ = -1;
+    bool accept_paused_ = false;
+    bool read_on_accept_ = false;   // first payload is likely there already
+    size_t read_batch_bytes_ = 0;
+    int read_batch_reads_ = 1;
+
+    RateLimit read_limit_;
+    RateLimit write_limit_;
+    std::vector<std::unique_ptr<PeerRateTable>> peer_rates_;  // parallel to loops_, empty when off
 };
@@ -0,0 +1,62 @@
+#pragma once
+
+#include "noncopyable.h"
+#include "channel.h"
+
+#include <functional>
+#include <memory>
+#include <queue>
+#include <vector>
+#include <unordered_map>
+#include <atomic>
+#include <cstdint>
+
+class EventLoop;
+
+using TimerId = uint64_t;      // 0 is never a valid timer
+
+/**
+ * per-loop timers on one timerfd ( CLOCK_MONOTONIC, absolute ),
+ * a min-heap of deadlines in steady microseconds
+ * add / cancel on the loop thread, EventLoop::runAfter & co. forward from other threads
+ * cancel is lazy: the heap entry stays until it surfaces and is skipped
+ */
+class TimerQueue : Noncopyable {
+public:
+    using Callback = std::function<void()>;
+
+    explicit TimerQueue(EventLoop *loop);
+    ~TimerQueue();
+
+    // ids can be reserved from any thread, so runAfter() can return one right away
+    TimerId nextId() { return nextId_.fetch_add(1, std::memory_order_relaxed); }
+
+    // when: steady micros, interval > 0 repeats
+    void add(TimerId id, int64_t when, int64_t interval, Callback cb);
+    void cancel(TimerId id);
+
+    size_t size() const { return timers_.size(); }
+
+private:
+    struct Entry {
+        int64_t when;
+        TimerId id;
+        bool operator>(const Entry &other) const { return when > other.when; }
+    };
+    struct Timer {
+        Callback cb;
+        int64_t interval;
+    };
+
+    void handleRead();
+    // program the timerfd for the earliest live deadline
+    void rearm();
+
+    EventLoop *loop_;
+    const int timerfd_;
+    Channel channel_;
+    std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> heap_;
+    std::unordered_map<TimerId, Timer> timers_;
+    int64_t armedAt_ = 0;   // deadline the timerfd holds, 0 = disarmed
+    std::atomic<TimerId> nextId_{1};
+};
@@ -0,0 +1,140 @@
+#pragma once
+
+#include "noncopyable.h"
+#include "eventloop.h"
+#include "channel.h"
+#include "socket.h"
+#include "inetaddr.h"
+#include "callback.h"
+#include "threadpool.h"
+#include "buffer/singletonBufferPool.h"
+
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <thread>
+#include <sys/socket.h>
+
+/**
+ * one udp socket on one eventloop
+ * reads drain the socket with recvmmsg into a fixed batch of pooled buffers,
+ * replies queued with send() during a batch leave in one sendmmsg after it
+ * with gso, runs of equal-sized replies to the same peer share one message
+ * ( UDP_SEGMENT ), with gro the kernel hands us coalesced datagrams that are
+ * split again before the callback
+ * all methods run on the loop thread
+ */
+class UdpChannel : Noncopyable {
+public:
+    struct Options {
+        size_t maxDatagramSize = 2048;  // larger datagrams are dropped ( counted as truncated )
+        bool gro = false;               // UDP_GRO, receive slots become 64KB
+        bool gso = false;               // UDP_SEGMENT on the send path
+        int recvBufferBytes = 0;        // SO_RCVBUF / SO_SNDBUF, 0 keeps the system default
+        int sendBufferBytes = 0;
+    };
+
+    struct Stats {
+        std::atomic<uint64_t> received{0};
+        std::atomic<uint64_t> sent{0};
+        std::atomic<uint64_t> truncated{0};
+        std::atomic<uint64_t> dropped{0};       // send queue full or send error
+        std::atomic<uint64_t> recvSyscalls{0};
+        std::atomic<uint64_t> sendSyscalls{0};
+    };
+
+    static constexpr size_t kBatch = 64;
+    static constexpr size_t kMaxQueued = 1024;
+
+    // takes ownership of a bound datagram socket
+    // stats: external counters that outlive the channel, nullptr to keep them inside
+    UdpChannel(EventLoop *loop, int fd, const Options &options, DatagramCallback cb, Stats *stats = nullptr);
+    ~UdpChannel();
+
+    void start();
+
+    // copy a reply into the send queue, flushed after the current read batch
+    // ( or on the next loop iteration when called elsewhere )
+    void send(const InetAddress &peer, const char *data, size_t len);
+    void flush();
+
+    EventLoop* getLoop() const { return loop_; }
+    const Stats& stats() const { return *stats_; }
+
+private:
+    struct Outgoing {
+        PooledBuffer buf;
+        InetAddress peer;
+    };
+
+    void handleRead(TimeStamp ts);
+    void handleWrite();
+    void deliver(const char *data, size_t len, size_t segment, const InetAddress &peer, TimeStamp ts);
+    // pack queued replies into mmsghdrs, coalescing gso runs, return the message count
+    size_t buildSendBatch(size_t from, size_t *consumed);
+
+    EventLoop *loop_;
+    Socket socket_;
+    Channel channel_;
+    Options options_;
+    DatagramCallback callback_;
+    size_t slotSize_;
+    bool inReadBatch_ = false;
+    bool flushQueued_ = false;
+
+    // receive batch, allocated once and reused for every recvmmsg
+    std::vector<PooledBuffer> recvBuffers_;
+    std::vector<mmsghdr> recvMsgs_;
+    std::vector<iovec> recvIov_;
+    std::vector<sockaddr_storage> recvAddrs_;
+    std::vector<char> recvControl_;
+
+    std::vector<Outgoing> sendQueue_;
+    std::vector<mmsghdr> sendMsgs_;
+    std::vector<iovec> sendIov_;
+    std::vector<char> sendControl_;
+
+    Stats ownStats_;
+    Stats *stats_;
+};
+
+
+/**
+ * SO_REUSEPORT sharded udp server: one socket per loop bound to the same address,
+ * the kernel spreads datagrams by flow hash, every loop works alone
+ * shard 0 runs on the thread calling start(), the others on pool threads
+ */
+class UdpServer : Noncopyable {
+public:
+    using Options = UdpChannel::Options;
+
+    // binds every shard's socket right away, bind errors throw here
+    UdpServer(const InetAddress &addr, int thread_num = std::thread::hardware_concurrency(),
+              const Options &options = Options());
+    ~UdpServer();
+
+    // called on the shard's loop thread, set before start()
+    void set_datagram_callback(DatagramCallback cb) { callback_ = std::move(cb); }
+
+    // spawns the other shards and runs shard 0 until stop()
+    void start();
+    void stop();
+
+    uint64_t received() const;
+    uint64_t sent() const;
+    uint64_t dropped() const;
+
+private:
+    static int create_udp_socket(const InetAddress &addr, const Options &options);
+
+    InetAddress addr_;
+    Options options_;
+    DatagramCallback callback_;
+    std::vector<int> fds_;      // bound sockets not yet adopted by a channel
+
+    EventLoop main_loop_;
+    std::unique_ptr<UdpChannel> main_channel_;
+    std::vector<EventLoop*> loops_;             // other shards, owned by their worker
+    std::vector<std::unique_ptr<UdpChannel::Stats>> stats_;    // per shard, outlives the channels
+    std::unique_ptr<ThreadPool> threadpool_;
+};
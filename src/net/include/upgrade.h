@@ -0,0 +1,32 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <sys/types.h>
+
+/**
+ * hot upgrade plumbing: hand file descriptors to a freshly exec'd binary
+ * the old process spawns the new one with one end of a unix socketpair,
+ * whose number travels in kInheritEnv, and passes fds over it with SCM_RIGHTS
+ * a passed listen socket keeps its accept queue, so no connection is refused
+ */
+namespace upgrade {
+
+    constexpr const char* kInheritEnv = "REACTOR_UPGRADE_FD";
+
+    // fork + execve argv ( argv[0] is a path, e.g. "/proc/self/exe" ) with the
+    // environment plus kInheritEnv, return the child pid, *sock is our end of the pair
+    pid_t spawn(const std::vector<std::string> &argv, int *sock);
+
+    // in the new process: the socket from kInheritEnv, -1 when not started by an upgrade
+    int inheritedSocket();
+
+    // one message: payload bytes plus fds as SCM_RIGHTS ( blocking socket )
+    bool sendFds(int sock, const std::vector<int> &fds, const std::string &payload);
+    bool recvFds(int sock, std::vector<int> *fds, std::string *payload, size_t maxFds = 64);
+
+    // wait up to timeoutMs for one ack byte from the peer
+    bool waitAck(int sock, int timeoutMs);
+    bool sendAck(int sock);
+
+} // namespace upgrade
@@ -0,0 +1,95 @@
+#pragma once
+
+#include "noncopyable.h"
+#include "connector.h"
+#include "tcpconnection.h"
+#include "callback.h"
+
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+#include <functional>
+
+/**
+ * warm connections to one upstream, owned by and confined to one loop
+ * create one per io loop: a request handled on that loop borrows a connection of
+ * the same loop, no cross-thread handoff, and no connect on the hot path while
+ * idle connections are around
+ *
+ * acquire() hands out the most recently used idle connection ( LIFO, warm caches ),
+ * or queues the request and connects when below maxConnections
+ * a queued request fails ( null connection ) after the acquire timeout, or when the
+ * connect made for it hits an error retrying cannot fix
+ * release() puts a connection back, or closes it beyond maxIdle
+ * the pool's callbacks are set on every connection it makes
+ * destroying the pool detaches every connection from it, borrowed ones keep running,
+ * queued requests are dropped without a call
+ */
+class UpstreamPool : Noncopyable {
+public:
+    // conn is null if none could be had in time
+    using AcquireCallback = std::function<void(const TcpConnectionPtr&)>;
+
+    UpstreamPool(EventLoop *loop, const InetAddress &serverAddr, const std::string &name,
+                 size_t maxConnections = 64, size_t maxIdle = 16);
+    ~UpstreamPool();
+
+    void setMessageCallback(MessageCallback cb) { messageCallback_ = std::move(cb); }
+    void setConnectionCallback(ConnectionCallback cb) { connectionCallback_ = std::move(cb); }
+    void setRetryDelay(double initialSeconds, double maxSeconds) { initialDelay_ = initialSeconds; maxDelay_ = maxSeconds; }
+    // how long a queued acquire waits, 0 = forever
+    void setAcquireTimeout(double seconds) { acquireTimeout_ = seconds; }
+
+    // open connections up front, call before traffic arrives
+    void warmUp(size_t count);
+
+    // cb runs right away with an idle connection, or once one becomes available
+    void acquire(AcquireCallback cb);
+    void release(const TcpConnectionPtr &conn);
+
+    size_t idleCount() const { return idle_.size(); }
+    size_t borrowedCount() const { return borrowed_.size(); }
+    size_t connectingCount() const { return connectors_.size(); }
+    size_t totalCount() const { return total_; }
+    size_t waitingCount() const { return waiters_.size(); }
+
+private:
+    struct Waiter {
+        uint64_t id;
+        TimerId timer;      // 0 without a timeout
+        AcquireCallback cb;
+    };
+
+    void startConnect();
+    void newConnection(Connector *connector, int sockfd);
+    void connectFailed(Connector *connector, int err);
+    // forget a connector, freed once the loop is done with it ( we may be inside its callback )
+    void dropConnector(Connector *connector);
+    void removeConnection(const TcpConnectionPtr &conn);
+    // a connection is free, give it to a waiter or park it
+    void dispatch(const TcpConnectionPtr &conn);
+    void lend(const TcpConnectionPtr &conn, AcquireCallback &cb);
+    void expire(uint64_t waiterId);
+    void forget(const TcpConnectionPtr &conn);
+
+    EventLoop *loop_;
+    const InetAddress serverAddr_;
+    const std::string name_;
+    const size_t maxConnections_;
+    const size_t maxIdle_;
+    double initialDelay_ = 0.1;
+    double maxDelay_ = 10.0;
+    double acquireTimeout_ = 5.0;
+
+    std::vector<TcpConnectionPtr> idle_;        // back is the hottest
+    std::vector<TcpConnectionPtr> borrowed_;    // handed out, not released yet
+    std::deque<Waiter> waiters_;
+    std::vector<std::unique_ptr<Connector>> connectors_;   // in flight
+    size_t total_ = 0;         // idle + borrowed + connecting
+    uint64_t nextConnId_ = 0;
+    uint64_t nextWaiterId_ = 0;
+
+    MessageCallback messageCallback_;
+    ConnectionCallback connectionCallback_;
+};
@@ -1,5 +1,9 @@
 #pragma once
 
+#include "inetaddr.h"
+
 void set_nonblocking(int fd);
 int create_and_bind(const char* ip, int port);
+// inet or unix ( stale socket files are unlinked first )
+int create_and_bind(const InetAddress &addr);
 
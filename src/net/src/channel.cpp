@@ -1,11 +1,16 @@
 #include "channel.h"
+#include "eventloop.h"
+#include "tcpconnection.h"
 
 
 Channel::Channel(EventLoop *loop, int fd)
     : loop_(loop)
     , fd_(fd)
+    , tie_(nullptr)
     , events_(0)
-    , revents_(0)   {   }
+    , revents_(0)
+    , state_(ChannelState::INIT)
+    , generation_(0)   {   }
 
 // Channel is owned by TCPConnection
 // managed by epoller of eventloop
@@ -13,23 +18,27 @@ Channel::Channel(EventLoop *loop, int fd)
 Channel::~Channel(){
 }
 
-void Channel::tie(const std::shared_ptr<void> &conn){
-    tie_ = conn;    // copy-assigned by the obj to monitored
-    tied_ = true;
+void Channel::update(){
+    loop_->updateChannel(this);
+}
+
+void Channel::remove(){
+    loop_->removeChannel(this);
+}
+
+void Channel::tie(TcpConnection *conn){
+    tie_ = conn;    // the conn embeds this channel, no need to observe it
 }
 
 /**
- * guard from: 
- * 1. pending events on fd after conn is deleted
- * 2. fd is reused
- * 3. other reactor close the conn
+ * guard from the conn being destroyed inside its own callbacks (e.g. close)
+ * pending events after the conn is deleted, or on a reused fd,
+ * are already filtered by eventloop with the channel generation
  */
 void Channel::handleEvent(TimeStamp ts){
-    if(tied_){
-        auto guard = tie_.lock();
-        if(guard){
-            handleEventGuarded(ts);
-        } // else conn is closed
+    if(tie_){
+        TcpConnectionPtr guard(tie_);   // plain increment, conn is confined to this loop
+        handleEventGuarded(ts);
     }else{
         handleEventGuarded(ts);
     }
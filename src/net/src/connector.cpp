@@ -0,0 +1,142 @@
+#include "connector.h"
+#include "eventloop.h"
+#include "logger.h"
+
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+#include <sys/socket.h>
+
+Connector::Connector(EventLoop *loop, const InetAddress &serverAddr)
+    : loop_(loop)
+    , serverAddr_(serverAddr) {}
+
+Connector::~Connector(){
+    if(retryTimer_) loop_->cancel(retryTimer_);
+    if(channel_ && state_ == State::CONNECTING){
+        ::close(removeAndResetChannel());
+    }
+}
+
+void Connector::start(){
+    loop_->runInLoop([this]{
+        connect_ = true;
+        startInLoop();
+    });
+}
+
+void Connector::restart(){
+    state_ = State::DISCONNECTED;
+    retryDelay_ = initialDelay_;
+    connect_ = true;
+    startInLoop();
+}
+
+void Connector::stop(){
+    loop_->runInLoop([this]{
+        connect_ = false;
+        if(retryTimer_){
+            loop_->cancel(retryTimer_);
+            retryTimer_ = 0;
+        }
+        if(state_ == State::CONNECTING){
+            state_ = State::DISCONNECTED;
+            ::close(removeAndResetChannel());
+        }
+    });
+}
+
+void Connector::startInLoop(){
+    if(connect_ && state_ == State::DISCONNECTED) connect();
+}
+
+void Connector::connect(){
+    ++attempts_;
+    int sockfd = ::socket(serverAddr_.family(), SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if(sockfd < 0){
+        LOG_EVERY_T(LogLevel::ERROR, 1.0) << "Connector socket() failed: " << strerror(errno);
+        retry(-1);
+        return;
+    }
+    int ret = ::connect(sockfd, serverAddr_.getSockAddr(), serverAddr_.getSockLen());
+    int err = (ret == 0) ? 0 : errno;
+    switch(err){
+        case 0:
+        case EINPROGRESS:
+        case EINTR:
+        case EISCONN:
+            connecting(sockfd);
+            break;
+        // nobody there ( yet ), or out of local resources: try again later
+        case EAGAIN:
+        case EADDRINUSE:
+        case EADDRNOTAVAIL:
+        case ECONNREFUSED:
+        case ENETUNREACH:
+        case ENOENT:            // unix socket path not created yet
+            retry(sockfd);
+            break;
+        default:
+            LOG_ERROR << "Connector connect() to " << serverAddr_.toIpPort() << " failed: " << strerror(err);
+            ::close(sockfd);
+            state_ = State::DISCONNECTED;
+            connect_ = false;
+            // last thing we do, the owner may free us from here
+            if(connectFailedCallback_) connectFailedCallback_(err);
+            break;
+    }
+}
+
+void Connector::connecting(int sockfd){
+    state_ = State::CONNECTING;
+    channel_ = std::make_unique<Channel>(loop_, sockfd);
+    channel_->setWriteCallBack([this]{ handleWrite(); });
+    channel_->setErrorCallBack([this]{ handleError(); });
+    channel_->enableWriting();      // writable once the handshake is over, either way
+}
+
+int Connector::removeAndResetChannel(){
+    channel_->disableAll();
+    channel_->remove();
+    // the Channel object itself stays until the next attempt, we may be inside its handleEvent
+    return channel_->fd();
+}
+
+void Connector::handleWrite(){
+    if(state_ != State::CONNECTING) return;
+    int sockfd = removeAndResetChannel();
+    int err = 0;
+    socklen_t len = sizeof(err);
+    if(::getsockopt(sockfd, SOL_SOCKET, SO_ERROR, &err, &len) < 0) err = errno;
+    if(err){
+        LOG_EVERY_T(LogLevel::WARN, 1.0) << "Connector to " << serverAddr_.toIpPort() << " failed: " << strerror(err);
+        retry(sockfd);
+        return;
+    }
+    state_ = State::CONNECTED;
+    retryDelay_ = initialDelay_;
+    if(connect_ && newConnectionCallback_){
+        newConnectionCallback_(sockfd);
+    }else{
+        ::close(sockfd);
+    }
+}
+
+void Connector::handleError(){
+    if(state_ == State::CONNECTING){
+        // SO_ERROR tells why, handleWrite does the rest
+        handleWrite();
+    }
+}
+
+void Connector::retry(int sockfd){
+    if(sockfd >= 0) ::close(sockfd);
+    state_ = State::DISCONNECTED;
+    if(!connect_) return;
+    LOG_EVERY_T(LogLevel::INFO, 5.0) << "Connector retry " << serverAddr_.toIpPort() << " in " << retryDelay_ << "s";
+    retryTimer_ = loop_->runAfter(retryDelay_, [this]{
+        retryTimer_ = 0;
+        startInLoop();
+    });
+    retryDelay_ = std::min(retryDelay_ * 2, maxDelay_);
+}
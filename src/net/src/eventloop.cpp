@@ -1,7 +1,11 @@
 #include "eventloop.h"
 #include "logger.h"
+#include "tcpconnection.h"
 #include <iostream>
 #include <unistd.h>
+#include <cstring>
+#include <cerrno>
+#include <algorithm>
 #include <sys/eventfd.h>
 
 // prevent from creating more than one loop on a single thread
@@ -21,9 +25,11 @@ void EventLoop::updateEpoller(int operation, Channel* ch){
     int fd = ch->fd();
     epoll_event event{};        // auto init to zero with {}
     event.events = ch->events();
-    event.data.ptr = ch;
+    event.data.u64 = epollKey(fd, ch->generation());
     if(epoll_ctl( epollFd_, operation, fd, &event) < 0){
-        LOG_ERROR << "epoll_ctl failed on eventloop" << this;
+        int err = errno;    // the log header may clobber it
+        LOG_EVERY_T(LogLevel::ERROR, 1.0) << "epoll_ctl(" << operation << ", fd " << fd << ") failed on eventloop " << this
+                                           << ": " << strerror(err);
     }
 }
 
@@ -35,7 +41,8 @@ EventLoop::EventLoop()
     , eventList_(kEventListSize)
     , threadId_(CurrentThread::tid())
     , wakeupFd_(createWakeupFd()) 
-    , wakeupChannel_(new Channel(this, wakeupFd_)) {
+    , wakeupChannel_(new Channel(this, wakeupFd_))
+    , connectionSlab_(std::make_unique<SlabAllocator>(sizeof(TcpConnection))) {
     LOG_DEBUG << "Create a new eventloop on thread " << threadId_;
     if(t_loopInThisThread){
         LOG_FATAL << "Another eventloop" << t_loopInThisThread << "already created on thread" << threadId_;
@@ -48,27 +55,46 @@ EventLoop::EventLoop()
         LOG_DEBUG << "create a new epoll fd " << epollFd_ << " on thread" << threadId_;
     }
     // write something to eventfd to wakeup this eventloop
-    wakeupChannel_->setReadCallBack( [this] () { handleWakeup(); } );
+    wakeupChannel_->setReadCallBack( [this] (TimeStamp) { handleWakeup(); } );
     wakeupChannel_->enableReading();
-
+    timerQueue_ = std::make_unique<TimerQueue>(this);
 }
 
 EventLoop::~EventLoop(){
-    ::close(epollFd_);
+    // what was queued still runs ( e.g. a connection accepted for us ), then every
+    // connection left open is closed: its slot goes with the slab, its fd would leak
+    doPendingFunctors();
+    closeConnections();
+    {
+        // whatever the closes queued holds refs, drop them while the slab is there
+        std::vector<Functor> rest;
+        std::lock_guard<std::mutex> lock(mutex_);
+        rest.swap(pendingFunctors_);
+    }
+    timerQueue_.reset();
 
     wakeupChannel_->disableAll();
     wakeupChannel_->remove();
     ::close(wakeupFd_);
+    ::close(epollFd_);      // last, the channels above still deregister through it
 
     t_loopInThisThread = nullptr;
 }
 
+void EventLoop::closeConnections(){
+    connectionSlab_->forEachLive([](void *slot){
+        TcpConnection *conn = static_cast<TcpConnection*>(slot);
+        TcpConnectionPtr guard(conn);
+        conn->handleClose();
+    });
+}
+
 void EventLoop::updateChannel(Channel *ch){
     auto state = ch->state();
     if(state  == ChannelState::INIT){
         // add a new conn fd to poller
         int fd = ch->fd();
-        channels_[fd] = ch;
+        ch->setGeneration(channels_.insert(fd, ch));
 
         updateEpoller(EPOLL_CTL_ADD, ch);
         ch->setState(ChannelState::POLLING);
@@ -85,9 +111,9 @@ void EventLoop::updateChannel(Channel *ch){
         // add back to fd set
         // check if is removed from the channel map
         int fd = ch->fd();
-        if( channels_.find(fd) == channels_.end() || channels_[fd] != ch ){
+        if( !channels_.contains(fd, ch, ch->generation()) ){
             // the original channel is removed
-            LOG_ERROR << "Try updating a removed channel";
+            LOG_FIRST_N(LogLevel::ERROR, 10) << "Try updating a removed channel";
         }else{
             // add back to epoller
             updateEpoller(EPOLL_CTL_ADD, ch);
@@ -97,7 +123,7 @@ void EventLoop::updateChannel(Channel *ch){
 }
 // the state is kinda chaos
 void EventLoop::removeChannel(Channel *ch){
-    channels_.erase(ch->fd());
+    channels_.erase(ch->fd(), ch);
     if(ch->state() == ChannelState::POLLING){
         updateEpoller(EPOLL_CTL_DEL, ch);
     }
@@ -106,22 +132,23 @@ void EventLoop::removeChannel(Channel *ch){
 
 
 bool EventLoop::hasChannel(Channel *ch){
-    return channels_.find(ch->fd()) != channels_.end() && channels_[ch->fd()] == ch;
+    return channels_.contains(ch->fd(), ch, ch->generation());
 }
 
 void EventLoop::wakeup(){
     uint64_t one = 1;
     auto n = write(wakeupFd_, &one, sizeof(one));
     if(n != sizeof(one)){
-        LOG_ERROR << "Writing wakeup fd more than 8 bytes";
+        LOG_EVERY_T(LogLevel::ERROR, 1.0) << "Writing wakeup fd more than 8 bytes";
     }
 }
 
 void EventLoop::handleWakeup(){
     uint64_t buf{};
     auto n = read(wakeupFd_, &buf, sizeof(buf));
-    if(buf != 1 || n != sizeof(buf)){
-        LOG_ERROR << "Wakeup fd polluted";
+    // counter accumulates when several threads queue functors before we wake up
+    if(buf == 0 || n != sizeof(buf)){
+        LOG_EVERY_T(LogLevel::ERROR, 1.0) << "Wakeup fd polluted";
     }
 }
 
@@ -131,31 +158,45 @@ void EventLoop::run(){
     stop_ = false;
     // reuse eventList buffer while supporting dynamic extention
     while (!stop_) {
-        activeChannels_.clear();
+        busySince_.store(0, std::memory_order_relaxed);
         int n = epoll_wait(epollFd_, eventList_.data() , static_cast<int>(eventList_.size()), 100); // 100ms超时
-        lastEpollTime_ = TimeStamp::now();
+        int err = errno;
+        LoopClock::refresh();    // the only clock read per iteration, everyone else reuses it
+        lastEpollTime_ = LoopClock::now();
+        busySince_.store(LoopClock::steadyMicros(), std::memory_order_relaxed);
         if (n == -1) {
-            if (errno == EINTR) continue;
-            LOG_ERROR << "epoll_wait() failed";
+            if (err == EINTR) continue;
+            LOG_EVERY_T(LogLevel::ERROR, 1.0) << "epoll_wait() failed: " << strerror(err);
         }
         if (n == eventList_.size()) {   // manualy resize since we use it as static array
             eventList_.resize(eventList_.size() * 2);
         }
-        for (int i = 0; i < n; ++i) {
-            Channel *channel = static_cast<Channel*>(eventList_[i].data.ptr);
-            channel->setRevents(eventList_[i].events);
-            activeChannels_.push_back(channel);
-        }
         // a middle layer can support priority, filter... in the future
-        for (Channel *channel : activeChannels_){
+        for (int i = 0; i < n; ++i){
+            uint64_t key = eventList_[i].data.u64;
+            // resolve late: an earlier handler in this batch may have closed this channel
+            Channel *channel = channels_.find(static_cast<int>(key & 0xffffffffu), static_cast<uint32_t>(key >> 32));
+            if(!channel) continue;
+            channel->setRevents(eventList_[i].events);
             channel->handleEvent(lastEpollTime_);
         }
 
         doPendingFunctors();
+
+        // rises at once, decays over a few iterations
+        int64_t busy = Clock::steadyMicros() - LoopClock::steadyMicros();
+        int64_t lag = lagMicros_.load(std::memory_order_relaxed);
+        lagMicros_.store(busy >= lag ? busy : lag - (lag - busy) / 8, std::memory_order_relaxed);
     }
     looping_ = false;
 }
 
+int64_t EventLoop::lagMicros() const {
+    int64_t since = busySince_.load(std::memory_order_relaxed);
+    int64_t stuck = since ? Clock::steadyMicros() - since : 0;
+    return std::max(stuck, lagMicros_.load(std::memory_order_relaxed));
+}
+
 void EventLoop::stop() {
     stop_ = true;
     // wakeup blocking epoll_wait() so can destruct inmediately
@@ -163,6 +204,50 @@ void EventLoop::stop() {
     // current thread calling stop means not blocked
 }
 
+TimerId EventLoop::runAt(int64_t steadyMicros, Functor cb){
+    TimerId id = timerQueue_->nextId();
+    runInLoop([this, id, steadyMicros, cb = std::move(cb)]() mutable {
+        timerQueue_->add(id, steadyMicros, 0, std::move(cb));
+    });
+    return id;
+}
+
+TimerId EventLoop::runAfter(double delaySeconds, Functor cb){
+    return runAt(LoopClock::steadyMicros() + static_cast<int64_t>(delaySeconds * 1000000), std::move(cb));
+}
+
+TimerId EventLoop::runEvery(double intervalSeconds, Functor cb){
+    TimerId id = timerQueue_->nextId();
+    int64_t interval = std::max<int64_t>(static_cast<int64_t>(intervalSeconds * 1000000), 1);
+    runInLoop([this, id, interval, cb = std::move(cb)]() mutable {
+        timerQueue_->add(id, LoopClock::steadyMicros() + interval, interval, std::move(cb));
+    });
+    return id;
+}
+
+void EventLoop::cancel(TimerId id){
+    runInLoop([this, id] { timerQueue_->cancel(id); });
+}
+
+void EventLoop::runInLoop(Functor cb){
+    if(isInLoopThread()){
+        cb();
+    }else{
+        queueInLoop(std::move(cb));
+    }
+}
+
+void EventLoop::queueInLoop(Functor cb){
+    {
+        std::unique_lock<std::mutex> lock{mutex_};
+        pendingFunctors_.push_back(std::move(cb));
+    }
+    // the loop may be blocked in epoll_wait, or already past this round of functors
+    if(!isInLoopThread() || doingPendingFunctors_){
+        wakeup();
+    }
+}
+
 void EventLoop::doPendingFunctors(){
     std::vector<Functor> functors;
     doingPendingFunctors_ = true;
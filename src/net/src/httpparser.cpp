@@ -0,0 +1,108 @@
+#include "httpparser.h"
+#include "simd_search.h"
+
+#include <strings.h>
+
+namespace {
+    bool equalsIgnoreCase(std::string_view a, std::string_view b) {
+        return a.size() == b.size() && ::strncasecmp(a.data(), b.data(), a.size()) == 0;
+    }
+
+    std::string_view trim(std::string_view s) {
+        while (!s.empty() && (s.front() == ' ' || s.front() == '\t')) s.remove_prefix(1);
+        while (!s.empty() && (s.back() == ' ' || s.back() == '\t')) s.remove_suffix(1);
+        return s;
+    }
+
+    // strict decimal, no sign, no overflow
+    bool parseSize(std::string_view s, size_t *out) {
+        if (s.empty() || s.size() > 18) return false;
+        size_t v = 0;
+        for (char c : s) {
+            if (c < '0' || c > '9') return false;
+            v = v * 10 + static_cast<size_t>(c - '0');
+        }
+        *out = v;
+        return true;
+    }
+}
+
+std::string_view HttpRequest::header(std::string_view name) const {
+    for (size_t i = 0; i < headerCount; ++i) {
+        if (equalsIgnoreCase(headers[i].name, name)) return headers[i].value;
+    }
+    return {};
+}
+
+HttpParser::Result HttpParser::parse(const char *data, size_t len, HttpRequest *req) {
+    if (headerLen_ == 0) {
+        // resume the search a few bytes back, the delimiter may straddle two reads
+        size_t from = scanned_ > 3 ? scanned_ - 3 : 0;
+        const char *end = data + len;
+        const char *p = simd::findDoubleCRLF(data + from, end);
+        if (p == end) {
+            scanned_ = len;
+            return len > kMaxHeaderBytes ? Result::ERROR : Result::INCOMPLETE;
+        }
+        headerLen_ = static_cast<size_t>(p - data) + 4;
+        if (!parseHead(data, req)) return Result::ERROR;
+        if (len >= consumed()) {
+            req->body = std::string_view(data + headerLen_, contentLength_);
+            return Result::COMPLETE;
+        }
+        return Result::INCOMPLETE;
+    }
+    // header known, waiting for the body
+    if (len < consumed()) return Result::INCOMPLETE;
+    // views from the earlier call may be stale, the buffer could have moved
+    if (!parseHead(data, req)) return Result::ERROR;
+    req->body = std::string_view(data + headerLen_, contentLength_);
+    return Result::COMPLETE;
+}
+
+bool HttpParser::parseHead(const char *data, HttpRequest *req) {
+    const char *end = data + headerLen_ - 2;    // keep the last "\r\n" as the terminator of the last line
+    const char *lineEnd = simd::findCRLF(data, end);
+    std::string_view line(data, static_cast<size_t>(lineEnd - data));
+
+    // request line: METHOD SP TARGET SP HTTP/1.x
+    size_t sp1 = line.find(' ');
+    size_t sp2 = sp1 == std::string_view::npos ? sp1 : line.find(' ', sp1 + 1);
+    if (sp2 == std::string_view::npos || sp1 == 0 || sp2 == sp1 + 1) return false;
+    req->method = line.substr(0, sp1);
+    req->target = line.substr(sp1 + 1, sp2 - sp1 - 1);
+    std::string_view version = line.substr(sp2 + 1);
+    if (version.size() != 8 || version.substr(0, 7) != "HTTP/1." || version[7] < '0' || version[7] > '9') return false;
+    req->versionMinor = version[7] - '0';
+    size_t q = req->target.find('?');
+    req->path = req->target.substr(0, q);
+    req->query = q == std::string_view::npos ? std::string_view() : req->target.substr(q + 1);
+
+    req->headerCount = 0;
+    bool hasLength = false;
+    contentLength_ = 0;
+    req->keepAlive = req->versionMinor >= 1;
+    const char *p = lineEnd + 2;
+    while (p < end) {
+        lineEnd = simd::findCRLF(p, end);
+        std::string_view hline(p, static_cast<size_t>(lineEnd - p));
+        p = lineEnd + 2;
+        size_t colon = hline.find(':');
+        if (colon == std::string_view::npos || colon == 0) return false;
+        if (req->headerCount == HttpRequest::kMaxHeaders) return false;
+        HttpHeader &h = req->headers[req->headerCount++];
+        h.name = hline.substr(0, colon);
+        h.value = trim(hline.substr(colon + 1));
+
+        if (equalsIgnoreCase(h.name, "Content-Length")) {
+            if (hasLength || !parseSize(h.value, &contentLength_)) return false;
+            hasLength = true;
+        } else if (equalsIgnoreCase(h.name, "Transfer-Encoding")) {
+            return false;   // chunked request bodies are not supported
+        } else if (equalsIgnoreCase(h.name, "Connection")) {
+            if (equalsIgnoreCase(h.value, "close")) req->keepAlive = false;
+            else if (equalsIgnoreCase(h.value, "keep-alive")) req->keepAlive = true;
+        }
+    }
+    return contentLength_ <= maxBodyBytes_;
+}
@@ -0,0 +1,29 @@
+#include "httpresponse.h"
+#include "buffer/singletonBufferPool.h"
+#include "timestamp.h"
+
+#include <cstdio>
+
+void HttpResponse::appendToBuffer(Buffer *out) const {
+    char line[64];
+    int n = snprintf(line, sizeof(line), "HTTP/1.1 %d ", statusCode_);
+    out->append(line, static_cast<size_t>(n));
+    out->append(reason_.data(), reason_.size());
+    out->append("\r\n", 2);
+
+    n = snprintf(line, sizeof(line), "Content-Length: %zu\r\n", body_.size());
+    out->append(line, static_cast<size_t>(n));
+    // second resolution is all Date needs, cached per thread
+    char date[TimeStamp::kHttpDateSize];
+    out->append("Date: ", 6);
+    out->append(date, TimeStamp::nowCoarse().formatHttpDate(date));
+    out->append("\r\n", 2);
+    if (closeConnection_) {
+        out->append("Connection: close\r\n", 19);
+    } else if (versionMinor_ == 0) {
+        out->append("Connection: keep-alive\r\n", 24);
+    }
+    out->append(headers_.data(), headers_.size());
+    out->append("\r\n", 2);
+    out->append(body_.data(), body_.size());
+}
@@ -0,0 +1,77 @@
+#include "httpserver.h"
+#include "logger.h"
+
+#include <any>
+
+namespace {
+    // per io thread scratch, reused by every connection of that loop
+    thread_local HttpRequest t_request;
+    thread_local HttpResponse t_response;
+    thread_local Buffer t_batch(16 * 1024);
+}
+
+HttpServer::HttpServer(const char *ip, int port, int thread_num)
+    : HttpServer(InetAddress(ip ? std::string(ip) : std::string("0.0.0.0"), static_cast<uint16_t>(port)), thread_num) {}
+
+HttpServer::HttpServer(const InetAddress &listenAddr, int thread_num)
+    : server_(listenAddr, thread_num) {
+    server_.set_connection_callback([this](TcpConnectionPtr conn) { onConnection(conn); });
+    server_.set_message_callback([this](const TcpConnectionPtr &conn, Buffer *buf, TimeStamp ts) {
+        onMessage(conn, buf, ts);
+    });
+}
+
+void HttpServer::onConnection(const TcpConnectionPtr &conn) {
+    if (conn->connected()) {
+        conn->setContext(HttpParser(maxBodyBytes_));
+    }
+}
+
+void HttpServer::onMessage(const TcpConnectionPtr &conn, Buffer *buf, TimeStamp) {
+    HttpParser *parser = std::any_cast<HttpParser>(conn->getMutableContext());
+    if (!parser) return;
+    if (!conn->connected()) {
+        // shutting down after an error or Connection: close, whatever comes until the FIN is dropped
+        buf->retrieveAll();
+        return;
+    }
+
+    bool close = false;
+    t_batch.retrieveAll();
+    // pipelining: drain every complete request of this read
+    while (!close) {
+        HttpParser::Result r = parser->parse(buf->readPtr(), buf->readableBytes(), &t_request);
+        if (r == HttpParser::Result::INCOMPLETE) break;
+        if (r == HttpParser::Result::ERROR) {
+            static const char kBadRequest[] = "HTTP/1.1 400 Bad Request\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+            t_batch.append(kBadRequest, sizeof(kBadRequest) - 1);
+            buf->retrieveAll();
+            parser->reset();
+            close = true;
+            break;
+        }
+
+        t_response.clear();
+        t_response.setCloseConnection(!t_request.keepAlive);
+        t_response.setVersionMinor(t_request.versionMinor);
+        if (httpCallback_) {
+            httpCallback_(t_request, &t_response);
+        } else {
+            t_response.setStatus(404, "Not Found");
+        }
+        t_response.appendToBuffer(&t_batch);
+        close = t_response.closeConnection();
+
+        buf->retrieve(parser->consumed());
+        parser->reset();
+    }
+
+    // one write for the whole batch
+    if (t_batch.readableBytes() > 0) {
+        conn->send(t_batch);
+        t_batch.retrieveAll();
+    }
+    if (close) {
+        conn->shutdown();
+    }
+}
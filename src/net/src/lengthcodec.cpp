@@ -0,0 +1,99 @@
+#include "lengthcodec.h"
+#include "tcpconnection.h"
+#include "logger.h"
+
+
+LengthCodec::LengthCodec(LengthEncoding encoding, int width, size_t maxFrameSize, FrameCallback cb)
+    : encoding_(encoding)
+    , width_(static_cast<size_t>(width))
+    , maxFrameSize_(maxFrameSize)
+    , frameCallback_(std::move(cb)) {
+    if(encoding_ != LengthEncoding::VARINT && width_ != 1 && width_ != 2 && width_ != 4 && width_ != 8){
+        LOG_FATAL << "LengthCodec: unsupported length width " << width;
+    }
+}
+
+LengthCodec::ParseResult LengthCodec::parseHeader(const char *data, size_t readable, size_t *headerLen, uint64_t *frameLen) const {
+    const unsigned char *p = reinterpret_cast<const unsigned char*>(data);
+    uint64_t len = 0;
+    if(encoding_ == LengthEncoding::VARINT){
+        // LEB128, 7 bits per byte, high bit set means more bytes follow
+        size_t i = 0;
+        for(; i < readable && i < kMaxVarintBytes; ++i){
+            len |= static_cast<uint64_t>(p[i] & 0x7f) << (7 * i);
+            if(!(p[i] & 0x80)) break;
+        }
+        if(i == kMaxVarintBytes) return ParseResult::ERROR;
+        if(i == readable) return ParseResult::NEED_MORE;
+        *headerLen = i + 1;
+    }else{
+        if(readable < width_) return ParseResult::NEED_MORE;
+        for(size_t i = 0; i < width_; ++i){
+            size_t shift = encoding_ == LengthEncoding::FIXED_BIG_ENDIAN ? (width_ - 1 - i) : i;
+            len |= static_cast<uint64_t>(p[i]) << (8 * shift);
+        }
+        *headerLen = width_;
+    }
+    *frameLen = len;
+    return len > maxFrameSize_ ? ParseResult::ERROR : ParseResult::OK;
+}
+
+void LengthCodec::onMessage(const TcpConnectionPtr &conn, Buffer *buf, TimeStamp ts) const {
+    // dispatch every complete frame of this batch straight from the buffer
+    while(conn->connected()){
+        size_t headerLen = 0;
+        uint64_t frameLen = 0;
+        ParseResult r = parseHeader(buf->readPtr(), buf->readableBytes(), &headerLen, &frameLen);
+        if(r == ParseResult::ERROR){
+            LOG_ERROR << "LengthCodec: bad or oversized frame ( limit " << maxFrameSize_ << " ) on " << conn->name();
+            buf->retrieveAll();
+            conn->forceClose();
+            return;
+        }
+        if(r == ParseResult::NEED_MORE){
+            conn->setReadSizeHint(maxHeaderSize());
+            return;
+        }
+        size_t total = headerLen + static_cast<size_t>(frameLen);
+        if(buf->readableBytes() < total){
+            // partial frame stays buffered, make room for the rest in one read
+            conn->setReadSizeHint(total - buf->readableBytes());
+            return;
+        }
+        frameCallback_(conn, std::string_view(buf->readPtr() + headerLen, static_cast<size_t>(frameLen)), ts);
+        buf->retrieve(total);
+    }
+}
+
+bool LengthCodec::encode(Buffer *payload) const {
+    uint64_t len = payload->readableBytes();
+    bool fits = encoding_ == LengthEncoding::VARINT || width_ == 8 || len < (uint64_t(1) << (8 * width_));
+    if(!fits || len > maxFrameSize_){
+        LOG_ERROR << "LengthCodec: frame of " << len << " bytes does not fit ( width " << width_
+                  << ", limit " << maxFrameSize_ << " ), dropped";
+        return false;
+    }
+    unsigned char header[kMaxVarintBytes];
+    size_t n = 0;
+    if(encoding_ == LengthEncoding::VARINT){
+        do{
+            unsigned char b = len & 0x7f;
+            len >>= 7;
+            header[n++] = len ? (b | 0x80) : b;
+        }while(len);
+    }else{
+        for(; n < width_; ++n){
+            size_t shift = encoding_ == LengthEncoding::FIXED_BIG_ENDIAN ? (width_ - 1 - n) : n;
+            header[n] = static_cast<unsigned char>(len >> (8 * shift));
+        }
+    }
+    payload->prepend(header, n);
+    return true;
+}
+
+bool LengthCodec::send(const TcpConnectionPtr &conn, Buffer *payload) const {
+    if(!encode(payload)) return false;
+    conn->send(*payload);
+    payload->retrieveAll();
+    return true;
+}
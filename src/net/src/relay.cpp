@@ -0,0 +1,180 @@
+#include "relay.h"
+#include "tcpconnection.h"
+#include "logger.h"
+
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace {
+    constexpr int kPipeSize = 256 * 1024;   // asked for, the kernel may give less
+    constexpr int kMaxPumpRounds = 16;      // per event, keeps the loop fair to other connections
+    std::atomic<size_t> g_bytesRelayed{0};
+}
+
+bool Relay::start(const TcpConnectionPtr &a, const TcpConnectionPtr &b){
+    if(!a || !b || a->getLoop() != b->getLoop() || !a->getLoop()->isInLoopThread()){
+        LOG_ERROR << "Relay needs two connections of the calling loop";
+        return false;
+    }
+    if(a->relay_ || b->relay_ || !a->connected() || !b->connected()) return false;
+    Relay *relay = new Relay(a, b);
+    if(!relay->init()){
+        delete relay;
+        return false;
+    }
+    return true;
+}
+
+size_t Relay::bytesRelayed(){
+    return g_bytesRelayed.load(std::memory_order_relaxed);
+}
+
+Relay::Relay(const TcpConnectionPtr &a, const TcpConnectionPtr &b)
+    : loop_(a->getLoop())
+    , a_(a)
+    , b_(b) {
+    dirs_[0].from = a.get();
+    dirs_[0].to = b.get();
+    dirs_[1].from = b.get();
+    dirs_[1].to = a.get();
+}
+
+Relay::~Relay(){
+    for(auto &d : dirs_){
+        if(d.pipe[0] >= 0) ::close(d.pipe[0]);
+        if(d.pipe[1] >= 0) ::close(d.pipe[1]);
+    }
+}
+
+bool Relay::init(){
+    for(auto &d : dirs_){
+        if(::pipe2(d.pipe, O_NONBLOCK | O_CLOEXEC) < 0){
+            LOG_ERROR << "Relay pipe2() failed: " << strerror(errno);
+            return false;
+        }
+        ::fcntl(d.pipe[1], F_SETPIPE_SZ, kPipeSize);
+        int cap = ::fcntl(d.pipe[1], F_GETPIPE_SZ);
+        pipeCapacity_ = cap > 0 ? static_cast<size_t>(cap) : 65536;
+    }
+
+    for(auto &d : dirs_){
+        // bytes read before the relay started go first, in order
+        Buffer &pending = d.from->inputBuffer_;
+        if(pending.readableBytes()){
+            d.to->sendInLoop(pending.readPtr(), pending.readableBytes());
+            pending.retrieveAll();
+        }
+    }
+    a_->relay_ = this;
+    b_->relay_ = this;
+    attached_ = 2;
+    // both may have data waiting already
+    pump(dirs_[0]);
+    if(!closing_) pump(dirs_[1]);
+    return true;
+}
+
+void Relay::onReadable(TcpConnection *conn){
+    pump(dirs_[0].from == conn ? dirs_[0] : dirs_[1]);
+}
+
+void Relay::onWritable(TcpConnection *conn){
+    pump(dirs_[0].to == conn ? dirs_[0] : dirs_[1]);
+}
+
+void Relay::pump(Direction &d){
+    if(closing_) return;
+    const int in = d.from->socket_.fd();
+    const int out = d.to->socket_.fd();
+    // output the connection buffered itself ( see init ) must leave before spliced bytes
+    bool sinkBusy = d.to->outputBuffer_.readableBytes() > 0;
+    bool sinkBlocked = sinkBusy;
+
+    for(int round = 0; round < kMaxPumpRounds; ++round){
+        bool progress = false;
+        if(!d.eof && d.inPipe < pipeCapacity_){
+            ssize_t n = ::splice(in, nullptr, d.pipe[1], nullptr, pipeCapacity_ - d.inPipe,
+                                 SPLICE_F_NONBLOCK | SPLICE_F_MOVE);
+            if(n > 0){
+                d.inPipe += static_cast<size_t>(n);
+                progress = true;
+            }else if(n == 0){
+                d.eof = true;
+            }else if(errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR){
+                fail("splice from socket");
+                return;
+            }
+        }
+        if(d.inPipe > 0 && !sinkBusy){
+            ssize_t n = ::splice(d.pipe[0], nullptr, out, nullptr, d.inPipe,
+                                 SPLICE_F_NONBLOCK | SPLICE_F_MOVE);
+            if(n > 0){
+                d.inPipe -= static_cast<size_t>(n);
+                g_bytesRelayed.fetch_add(static_cast<size_t>(n), std::memory_order_relaxed);
+                progress = true;
+                sinkBlocked = false;
+            }else if(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)){
+                sinkBlocked = true;
+            }else if(n < 0 && errno != EINTR){
+                fail("splice to socket");
+                return;
+            }
+        }
+        if(!progress) break;
+    }
+
+    // interest follows the pipe: read while there is room, wait for the sink while there is data
+    Channel &src = d.from->channel_;
+    Channel &sink = d.to->channel_;
+    bool wantRead = !d.eof && d.inPipe < pipeCapacity_;
+    if(wantRead != src.isReading()){
+        wantRead ? src.enableReading() : src.disableReading();
+    }
+    bool wantWrite = (d.inPipe > 0 && sinkBlocked) || sinkBusy;
+    if(wantWrite && !sink.isWriting()) sink.enableWriting();
+    // the sink channel is shared with the other direction's source,
+    // drop write interest only when neither direction waits on it
+    else if(!wantWrite && sink.isWriting() && d.to->outputBuffer_.readableBytes() == 0) sink.disableWriting();
+
+    if(d.eof && d.inPipe == 0 && !d.done && !sinkBusy){
+        d.done = true;
+        d.to->socket_.shutdownWrite();      // pass the half-close on
+        finishIfDone();
+    }
+}
+
+void Relay::fail(const char *what){
+    LOG_EVERY_T(LogLevel::WARN, 1.0) << "Relay " << a_->name() << " <-> " << b_->name() << " " << what
+                                      << " failed: " << strerror(errno);
+    closing_ = true;
+    a_->forceClose();
+    b_->forceClose();
+}
+
+void Relay::finishIfDone(){
+    if(dirs_[0].done && dirs_[1].done && !closing_){
+        closing_ = true;
+        a_->forceClose();
+        b_->forceClose();
+    }
+}
+
+void Relay::onClose(TcpConnection *conn){
+    // one end went away ( reset, error, or our own forceClose ): the other follows
+    if(!closing_){
+        closing_ = true;
+        (conn == a_.get() ? b_ : a_)->forceClose();
+    }
+    detach(conn);
+}
+
+void Relay::detach(TcpConnection *conn){
+    conn->relay_ = nullptr;
+    if(--attached_ == 0){
+        // we may be deep inside one of our own calls, free after this event
+        loop_->queueInLoop([this]{ delete this; });
+    }
+}
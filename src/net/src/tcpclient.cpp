@@ -0,0 +1,60 @@
+#include "tcpclient.h"
+#include "logger.h"
+
+#include <sys/socket.h>
+
+TcpClient::TcpClient(EventLoop *loop, const InetAddress &serverAddr, const std::string &name)
+    : loop_(loop)
+    , connector_(std::make_unique<Connector>(loop, serverAddr))
+    , name_(name) {
+    connector_->setNewConnectionCallback([this](int sockfd){ newConnection(sockfd); });
+}
+
+TcpClient::~TcpClient(){
+    if(connection_){
+        // the connection may outlive us, it must not call back into a dead client
+        connection_->setCloseCallback(CloseCallback());
+        connection_->forceClose();
+    }
+}
+
+void TcpClient::connect(){
+    connect_ = true;
+    connector_->start();
+}
+
+void TcpClient::disconnect(){
+    connect_ = false;
+    if(connection_) connection_->shutdown();
+}
+
+void TcpClient::stop(){
+    connect_ = false;
+    connector_->stop();
+}
+
+void TcpClient::newConnection(int sockfd){
+    sockaddr_storage local{};
+    socklen_t len = sizeof(local);
+    ::getsockname(sockfd, reinterpret_cast<sockaddr*>(&local), &len);
+    InetAddress localAddr;
+    localAddr.setSockAddr(reinterpret_cast<sockaddr*>(&local), len);
+
+    const InetAddress &peer = connector_->serverAddress();
+    std::string name = name_ + ":" + peer.toIpPort() + "#" + std::to_string(nextConnId_++);
+    TcpConnectionPtr conn = TcpConnection::create(loop_, sockfd, name, localAddr, peer);
+    conn->setConnectionCallback(connectionCallback_);
+    conn->setMessageCallback(messageCallback_);
+    conn->setWriteCompleteCallback(writeCompleteCallback_);
+    conn->setCloseCallback([this](TcpConnectionPtr c){ removeConnection(c); });
+    connection_ = conn;
+    conn->establishConnection();
+}
+
+void TcpClient::removeConnection(const TcpConnectionPtr &conn){
+    if(connection_ == conn) connection_.reset();
+    if(retry_ && connect_){
+        LOG_INFO << "TcpClient " << name_ << " reconnecting to " << connector_->serverAddress().toIpPort();
+        connector_->restart();
+    }
+}
@@ -1,8 +1,24 @@
 #include "tcpconnection.h"
+#include "relay.h"
 #include <unistd.h>
+#include <sys/socket.h>
 #include <iostream>
+#include <cstdio>
+#include <new>
+#include <algorithm>
+#include <cstdint>
 
 
+TcpConnectionPtr TcpConnection::create(
+                    EventLoop* loop, 
+                    int fd, 
+                    const std::string &name, 
+                    const InetAddress &localAddr, 
+                    const InetAddress &clientAddr){
+    void *mem = loop->connectionSlab().allocate();
+    return TcpConnectionPtr(new (mem) TcpConnection(fd, loop, name, localAddr, clientAddr));
+}
+
 // create a channel, set callbacks for it 
 TcpConnection::TcpConnection(
                     int fd, 
@@ -11,47 +27,409 @@ TcpConnection::TcpConnection(
                     const InetAddress &localAddr, 
                     const InetAddress &clientAddr) 
     : loop_(loop)
-    , socket_(std::make_unique<Socket>(fd))
-    , channel_(std::make_unique<Channel>(loop, fd))
-    , name_(name)
-    , localAddr_(localAddr_)
+    , socket_(fd)
+    , channel_(loop, fd)
+    , registered_(false)
+    , localAddr_(localAddr)
     , clientAddr_(clientAddr)
     , state_(State::CONNECTING)
-    , highWaterMark_(64 * 1024 *1024){
-        channel_->setReadCallBack( [this](TimeStamp ts){ handleRead(ts); } );
-        channel_->setWriteCallBack( [this](){ handleWrite(); } );
-        channel_->setCloseCallBack( [this](){ handleClose(); } );
-        channel_->setErrorCallBack( [this](){ handleError(); } );
-        LOG_INFO << "TCP Connction " << name_.c_str() << " with " << clientAddr_.toIp() << " created at fd " << socket_->fd();
-        socket_->setKeepAlive(true);
+    , highWaterMark_(64 * 1024 *1024)
+    , lowWaterMark_(highWaterMark_ / 2)
+    , readPaused_(false)
+    , outputBudget_(nullptr)
+    , chargedBytes_(0)
+    , readSizeHint_(0){
+        snprintf(name_, sizeof(name_), "%s", name.c_str());
+        channel_.setReadCallBack( [this](TimeStamp ts){ handleRead(ts); } );
+        channel_.setWriteCallBack( [this](){ handleWrite(); } );
+        channel_.setCloseCallBack( [this](){ handleClose(); } );
+        channel_.setErrorCallBack( [this](){ handleError(); } );
+        inputBuffer_.setSpill(&BufferMemoryPool::spill);
+        outputBuffer_.setSpill(&BufferMemoryPool::spill);
+        LOG_INFO << "TCP Connction " << name_ << " with " << clientAddr_.toIp() << " created at fd " << socket_.fd();
+        if(!localAddr_.isUnix()) socket_.setKeepAlive(true);   // nothing to probe on a local socket
 
 }
 
 TcpConnection::~TcpConnection(){
     // socketfd closed in ~Socket()
-    LOG_INFO << "TCP Connection " << name_.c_str() << " with " << clientAddr_.toIp() << " closed fd " << socket_->fd();
+    if(outputBudget_ && chargedBytes_){
+        outputBudget_->charge(-static_cast<int64_t>(chargedBytes_));
+    }
+    if(peerBuckets_) peerBuckets_->table->release(peerBuckets_);
+    if(bufferMemory_ && bufferCharged_){
+        bufferMemory_->charge(-static_cast<int64_t>(bufferCharged_));
+    }
+    LOG_INFO << "TCP Connection " << name_ << " with " << clientAddr_.toIp() << " closed fd " << socket_.fd();
+}
+
+void TcpConnection::destroy(){
+    // never leave a dangling channel in the loop's table
+    if(loop_->hasChannel(&channel_)){
+        channel_.remove();
+    }
+    SlabAllocator &slab = loop_->connectionSlab();
+    this->~TcpConnection();
+    slab.deallocate(this);
+}
+
+void TcpConnection::unregister(){
+    if(registered_){
+        registered_ = false;
+        release();      // may destroy this, caller must hold its own guard
+    }
 }
 
 // the structure is fit for extending functions
-void TcpConnection::establishConnection(){
-    channel_->tie(shared_from_this());  // weak_ptr observer
-    channel_->enableReading();      // read from client
+void TcpConnection::establishConnection(bool readNow){
+    channel_.tie(this);     // ref held during event handling
+    channel_.enableReading();      // read from client
+    addRef();               // owned by the loop until closed
+    registered_ = true;
     
     setState(State::CONNECTED);
-    connectionCallback_(shared_from_this());
+    if(connectionCallback_) connectionCallback_(TcpConnectionPtr(this));
+    if(readNow && state_ == State::CONNECTED){
+        TcpConnectionPtr guard(this);
+        handleRead(loop_->now());   // EAGAIN if nothing came after all
+    }
 }
 
 // for Tcpserver ( local end ) to close the connection
 void TcpConnection::destroyConnection(){
+    TcpConnectionPtr guard(this);
     if(state_ == State::CONNECTED){
         setState(State::DISCONNECTED);
-        channel_->disableAll();
-        connectionCallback_(shared_from_this());
+        channel_.disableAll();
+        if(connectionCallback_) connectionCallback_(guard);
     }
-    channel_->remove();
+    channel_.remove();
+    unregister();
 }
 
 void TcpConnection::handleRead(TimeStamp ts){
-    
+    if(relay_){
+        relay_->onReadable(this);
+        return;
+    }
+    if(readSizeHint_){
+        inputBuffer_.ensureWritableBytes(readSizeHint_);
+        readSizeHint_ = 0;
+    }
+    size_t allowance = SIZE_MAX;
+    int64_t now = 0;
+    if(readLimited()){
+        now = loop_->steadyMicros();
+        allowance = rateAllowance(true, now);
+        if(allowance == 0){
+            throttle(true, now);
+            return;
+        }
+    }
+    // several reads per event only when batching is asked for, the byte cap still
+    // bounds it, the rest stays readable for the next iteration
+    size_t limit = readBatchBytes_ ? std::min(allowance, readBatchBytes_) : allowance;
+    size_t total = 0;
+    ssize_t n = 0;
+    for(int i = 0; i < readBatchReads_ && total < limit; ++i){
+        size_t want = limit - total;
+        if(i > 0) inputBuffer_.ensureWritableBytes(std::min(want, kReadChunk));   // last read filled the room
+        size_t room = std::min(std::max<size_t>(inputBuffer_.writableBytes(), 1), want);
+        n = inputBuffer_.readFromFD(socket_.fd(), want);
+        if(n <= 0) break;
+        total += static_cast<size_t>(n);
+        if(static_cast<size_t>(n) < room) break;    // socket drained
+    }
+    if(total > 0){
+        if(allowance != SIZE_MAX) chargeRate(true, total, now);
+        if(messageCallback_){
+            // no allocation, no refcount: the handler borrows our own buffer
+            messageCallback_(TcpConnectionPtr(this), &inputBuffer_, ts);
+        }else if(readDataCallback_){
+            // compatibility adapter, one copy per read
+            auto buf = std::make_shared<Buffer>(inputBuffer_.readableBytes());
+            buf->append(inputBuffer_.readPtr(), inputBuffer_.readableBytes());
+            inputBuffer_.retrieveAll();
+            readDataCallback_(TcpConnectionPtr(this), std::move(buf), ts);
+        }else{
+            inputBuffer_.retrieveAll();     // nobody listening, drop it
+        }
+        // a burst is over, do not sit on its memory
+        if(inputBuffer_.readableBytes() == 0 && inputBuffer_.heapBytes() > reclaimKeepBytes_){
+            inputBuffer_.shrink(0);
+        }
+        noteBufferUse();
+        // a FIN or error behind the data shows up on the next iteration
+    }else if(n == 0){
+        handleClose();      // peer sent FIN
+    }else if(errno != EAGAIN && errno != EWOULDBLOCK){
+        handleError();
+    }
+}
+
+// peer closed, or fatal error on the socket
+void TcpConnection::handleClose(){
+    if(state_ == State::DISCONNECTED) return;
+    TcpConnectionPtr guard(this);
+    setState(State::DISCONNECTED);
+    channel_.disableAll();
+    // pending output can never leave now, hand its share of the budget back
+    outputBuffer_.retrieveAll();
+    updateBackpressure();
+    if(connectionCallback_) connectionCallback_(guard);
+    if(closeCallback_) closeCallback_(guard);   // server side bookkeeping
+    if(relay_) relay_->onClose(this);
+    channel_.remove();
+    unregister();
+}
+
+void TcpConnection::forceClose(){
+    if(state_ == State::CONNECTED || state_ == State::DISCONNECTING){
+        setState(State::DISCONNECTING);
+        loop_->runInLoop([h = handle()]{
+            if(auto conn = h.lock()) conn->handleClose();
+        });
+    }
+}
+
+void TcpConnection::handleError(){
+    int err = 0;
+    socklen_t len = sizeof(err);
+    ::getsockopt(socket_.fd(), SOL_SOCKET, SO_ERROR, &err, &len);
+    LOG_ERROR << "TCP Connection " << name_ << " SO_ERROR = " << err;
+}
+
+void TcpConnection::send(const std::string &str){
+    send(str.data(), str.size());
+}
+
+void TcpConnection::send(const Buffer &buf){
+    send(buf.readPtr(), buf.readableBytes());
+}
+
+void TcpConnection::send(const char *data, size_t len){
+    if(state_ != State::CONNECTED) return;
+    if(loop_->isInLoopThread()){
+        sendInLoop(data, len);
+    }else{
+        // refs never cross threads, hand over a weak handle and a copy of the data
+        loop_->queueInLoop([h = handle(), msg = std::string(data, len)]{
+            if(auto conn = h.lock()) conn->sendInLoop(msg.data(), msg.size());
+        });
+    }
+}
+
+void TcpConnection::sendInLoop(const char *data, size_t len){
+    if(state_ == State::DISCONNECTED){
+        LOG_WARN << "TCP Connection " << name_ << " disconnected, give up writing";
+        return;
+    }
+    size_t written = 0;
+    // nothing queued: try the socket directly, skip the output buffer
+    if(!channel_.isWriting() && outputBuffer_.readableBytes() == 0 && !writeThrottled_){
+        size_t allowance = SIZE_MAX;
+        int64_t now = 0;
+        if(writeLimited()){
+            now = loop_->steadyMicros();
+            allowance = rateAllowance(false, now);
+        }
+        // MSG_NOSIGNAL: a peer that reset gives EPIPE here instead of killing the process
+        ssize_t n = allowance ? ::send(socket_.fd(), data, std::min(len, allowance), MSG_NOSIGNAL) : 0;
+        if(n >= 0){
+            written = static_cast<size_t>(n);
+            if(allowance != SIZE_MAX) chargeRate(false, written, now);
+            if(written == len && writeCompleteCallback_){
+                loop_->queueInLoop([h = handle()]{
+                    if(auto conn = h.lock()) conn->writeCompleteCallback_(conn);
+                });
+            }
+        }else if(errno != EAGAIN && errno != EWOULDBLOCK){
+            // EPIPE, ECONNRESET...: nothing queued here would ever leave, stop charging for it
+            int err = errno;
+            LOG_ERROR << "TCP Connection " << name_ << " write failed, errno " << err;
+            handleClose();
+            return;
+        }
+    }
+    if(written < len){
+        size_t before = outputBuffer_.readableBytes();
+        outputBuffer_.append(data + written, len - written);
+        size_t after = outputBuffer_.readableBytes();
+        if(before < highWaterMark_ && after >= highWaterMark_ && highWaterMarkCallback_){
+            loop_->queueInLoop([h = handle(), after]{
+                if(auto conn = h.lock()) conn->highWaterMarkCallback_(conn, after);
+            });
+        }
+        // a throttled connection gets write interest back from its timer
+        if(!channel_.isWriting() && !writeThrottled_) channel_.enableWriting();
+        updateBackpressure();
+        noteBufferUse();
+    }
+}
 
-}
\ No newline at end of file
+void TcpConnection::handleWrite(){
+    if(!channel_.isWriting()) return;
+    if(relay_ && outputBuffer_.readableBytes() == 0){
+        relay_->onWritable(this);
+        return;
+    }
+    size_t allowance = SIZE_MAX;
+    int64_t now = 0;
+    if(writeLimited()){
+        now = loop_->steadyMicros();
+        allowance = rateAllowance(false, now);
+        if(allowance == 0){
+            throttle(false, now);
+            return;
+        }
+    }
+    ssize_t n = outputBuffer_.writeToFD(socket_.fd(), allowance);
+    if(n > 0 && allowance != SIZE_MAX) chargeRate(false, static_cast<size_t>(n), now);
+    if(n < 0){
+        if(errno != EAGAIN && errno != EWOULDBLOCK){
+            int err = errno;
+            LOG_ERROR << "TCP Connection " << name_ << " handleWrite failed, errno " << err;
+            handleClose();
+        }
+        return;
+    }
+    if(outputBuffer_.readableBytes() == 0){
+        channel_.disableWriting();
+        if(outputBuffer_.heapBytes() > reclaimKeepBytes_) outputBuffer_.shrink(0);
+        if(writeCompleteCallback_) writeCompleteCallback_(TcpConnectionPtr(this));
+        if(state_ == State::DISCONNECTING) shutdownInLoop();
+    }
+    updateBackpressure();
+    noteBufferUse();
+    // buffered output is out, spliced bytes may follow
+    if(relay_ && outputBuffer_.readableBytes() == 0) relay_->onWritable(this);
+}
+
+void TcpConnection::updateBackpressure(){
+    size_t pending = outputBuffer_.readableBytes();
+    if(outputBudget_ && pending != chargedBytes_){
+        outputBudget_->charge(static_cast<int64_t>(pending) - static_cast<int64_t>(chargedBytes_));
+        chargedBytes_ = pending;
+    }
+    // the budget only throttles connections holding output, they are the ones
+    // that get write events to re-evaluate, so nobody stays paused forever
+    bool overBudget = outputBudget_ && pending > 0 && outputBudget_->exceeded();
+    if(!readPaused_){
+        if(pending >= highWaterMark_ || overBudget){
+            readPaused_ = true;
+            channel_.disableReading();
+            LOG_DEBUG << "TCP Connection " << name_ << " pause reading, pending output " << pending;
+        }
+    }else if(pending <= lowWaterMark_ && !overBudget){
+        readPaused_ = false;
+        if(state_ == State::CONNECTED && !readThrottled_) channel_.enableReading();
+        LOG_DEBUG << "TCP Connection " << name_ << " resume reading, pending output " << pending;
+    }
+}
+
+void TcpConnection::shutdown(){
+    if(state_ == State::CONNECTED){
+        setState(State::DISCONNECTING);
+        loop_->runInLoop([h = handle()]{
+            if(auto conn = h.lock()) conn->shutdownInLoop();
+        });
+    }
+}
+
+void TcpConnection::shutdownInLoop(){
+    // wait for pending output, handleWrite comes back here once drained
+    // ( a write-throttled connection holds output without polling for it )
+    if(!channel_.isWriting() && outputBuffer_.readableBytes() == 0){
+        socket_.shutdownWrite();
+    }
+}
+
+void TcpConnection::setRateLimits(const RateLimit &read, const RateLimit &write){
+    int64_t now = loop_->steadyMicros();
+    readBucket_.reset(read.bytesPerSecond, read.burstBytes, now);
+    writeBucket_.reset(write.bytesPerSecond, write.burstBytes, now);
+}
+
+size_t TcpConnection::rateAllowance(bool read, int64_t now){
+    double tokens = (read ? readBucket_ : writeBucket_).available(now);
+    if(peerBuckets_) tokens = std::min(tokens, (read ? peerBuckets_->read : peerBuckets_->write).available(now));
+    if(tokens < 1) return 0;
+    return tokens >= static_cast<double>(SIZE_MAX) ? SIZE_MAX : static_cast<size_t>(tokens);
+}
+
+void TcpConnection::chargeRate(bool read, size_t bytes, int64_t now){
+    (read ? readBucket_ : writeBucket_).take(static_cast<double>(bytes), now);
+    if(peerBuckets_) (read ? peerBuckets_->read : peerBuckets_->write).take(static_cast<double>(bytes), now);
+}
+
+void TcpConnection::throttle(bool read, int64_t now){
+    int64_t wait = (read ? readBucket_ : writeBucket_).microsUntil(kRateQuantum, now);
+    if(peerBuckets_) wait = std::max(wait, (read ? peerBuckets_->read : peerBuckets_->write).microsUntil(kRateQuantum, now));
+    wait = std::max<int64_t>(wait, 1000);
+    if(read){
+        readThrottled_ = true;
+        channel_.disableReading();
+    }else{
+        writeThrottled_ = true;
+        channel_.disableWriting();
+    }
+    // the timer only holds a weak handle, a connection closed meanwhile is skipped
+    loop_->runAfter(static_cast<double>(wait) / 1e6, [h = handle(), read]{
+        if(auto conn = h.lock()){
+            if(read) conn->resumeRead();
+            else conn->resumeWrite();
+        }
+    });
+}
+
+void TcpConnection::resumeRead(){
+    readThrottled_ = false;
+    if(state_ == State::CONNECTED && !readPaused_ && !relay_) channel_.enableReading();
+}
+
+void TcpConnection::resumeWrite(){
+    writeThrottled_ = false;
+    if(state_ != State::DISCONNECTED && outputBuffer_.readableBytes() > 0) channel_.enableWriting();
+}
+
+void TcpConnection::setBufferReclaim(size_t keepBytes, double idleSeconds){
+    reclaimKeepBytes_ = keepBytes;
+    reclaimIdleMicros_ = static_cast<int64_t>(idleSeconds * 1e6);
+}
+
+void TcpConnection::noteBufferUse(){
+    lastActive_ = loop_->steadyMicros();
+    updateBufferMemory();
+}
+
+void TcpConnection::updateBufferMemory(){
+    size_t heap = bufferHeapBytes();
+    if(bufferMemory_ && heap != bufferCharged_){
+        bufferMemory_->charge(static_cast<int64_t>(heap) - static_cast<int64_t>(bufferCharged_));
+        bufferCharged_ = heap;
+    }
+    // one timer per connection holding leased memory, it re-arms itself while there is traffic
+    if(reclaimIdleMicros_ && heap && !reclaimArmed_){
+        reclaimArmed_ = true;
+        loop_->runAfter(static_cast<double>(reclaimIdleMicros_) / 1e6, [h = handle()]{
+            if(auto conn = h.lock()) conn->reclaimIdleBuffers();
+        });
+    }
+}
+
+void TcpConnection::reclaimIdleBuffers(){
+    reclaimArmed_ = false;
+    if(state_ == State::DISCONNECTED) return;
+    int64_t idle = loop_->steadyMicros() - lastActive_;
+    if(idle >= reclaimIdleMicros_){
+        // pending data ( a stalled peer ) keeps its buffer
+        if(inputBuffer_.readableBytes() == 0) inputBuffer_.shrink(0);
+        if(outputBuffer_.readableBytes() == 0) outputBuffer_.shrink(0);
+        updateBufferMemory();   // re-arms only if something is still held
+        return;
+    }
+    reclaimArmed_ = true;
+    loop_->runAfter(static_cast<double>(reclaimIdleMicros_ - idle) / 1e6, [h = handle()]{
+        if(auto conn = h.lock()) conn->reclaimIdleBuffers();
+    });
+}
@@ -1,40 +1,57 @@
 #include "tcpserver.h"
 #include "util.h"
 #include <iostream>
+#include <future>
+#include <algorithm>
 #include <unistd.h>
+#include <fcntl.h>
+#include <csignal>
+#include <mutex>
+#include <sys/resource.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 
 TcpServer::TcpServer(const char *ip, int port, int io_thread_num)
-    : listen_fd_(create_and_bind(ip, port)),
+    : TcpServer(InetAddress(ip ? std::string(ip) : std::string("0.0.0.0"), static_cast<uint16_t>(port)), io_thread_num) {}
+
+TcpServer::TcpServer(const InetAddress &listen_addr, int io_thread_num)
+    : listen_socket_(bind_or_inherit(listen_addr, &upgrade_sock_)),
+      accept_channel_(&main_loop_, listen_socket_.fd()),
+      listen_addr_(listen_addr),
       io_thread_num_(io_thread_num),
       next_loop_index_(0),
+      next_conn_id_(0),
       timeout_manager_(300, [this](int fd)
                        { handle_timeout(fd); })
 {
 
-    set_nonblocking(listen_fd_);
+    set_nonblocking(listen_socket_.fd());
+    ignore_sigpipe();
+    // held back for the EMFILE case, see drop_with_reserve_fd()
+    reserve_fd_ = ::open("/dev/null", O_RDONLY | O_CLOEXEC);
+    set_overload_options(overload_);
 
     // main thread & main loop
     // only handle accept event
     // async-style, each time an event triggered, call the callback function
-    main_loop_.add_fd(listen_fd_, EPOLLIN | EPOLLET,
-                      [this](int fd, uint32_t events)
-                      { handle_accept(fd, events); });
-
-    main_thread_ = std::thread([this] {
-        main_loop_.run();  
-    });
+    accept_channel_.setReadCallBack([this](TimeStamp ts)
+                                    { handle_accept(ts); });
 
     // create threadpool for non-blocking network io
-    auto threadpool_ = std::make_unique<ThreadPool>(io_thread_num_);
+    threadpool_ = std::make_unique<ThreadPool>(io_thread_num_);
     for (int i = 0; i < io_thread_num_; ++i)
     {
-        loops_.emplace_back(new EventLoop());
-        // eventloop is not running until we add_fd for it.
-        threadpool_->enqueue([this, i]
-                              { loops_[i]->run(); });
-
+        // the loop must be created on the thread that runs it,
+        // so thread id checks ( isInLoopThread ) hold
+        auto ready = std::make_shared<std::promise<EventLoop*>>();
+        auto loop_future = ready->get_future();
+        threadpool_->enqueue([ready]
+                              {
+                                  EventLoop loop;
+                                  ready->set_value(&loop);
+                                  loop.run();
+                              });
+        loops_.push_back(loop_future.get());
     }
 
     // allocate timeout thread
@@ -47,12 +64,32 @@ TcpServer::TcpServer(const char *ip, int port, int io_thread_num)
 
 }
 
+void TcpServer::ignore_sigpipe() {
+    // sends carry MSG_NOSIGNAL, but a relay splicing into a reset socket still raises
+    // SIGPIPE; leave alone a handler the application installed
+    static std::once_flag once;
+    std::call_once(once, [] {
+        struct sigaction old{};
+        if (::sigaction(SIGPIPE, nullptr, &old) == 0 && old.sa_handler == SIG_DFL) ::signal(SIGPIPE, SIG_IGN);
+    });
+}
+
 TcpServer::~TcpServer(){
     stop();
+    if (reserve_fd_ >= 0) ::close(reserve_fd_);
 }
 
 void TcpServer::start(){
     running_ = true;
+    accept_channel_.enableReading();
+    if (upgrade_sock_ >= 0) {
+        // we accept now, the old process may stop
+        upgrade::sendAck(upgrade_sock_);
+        ::close(upgrade_sock_);
+        upgrade_sock_ = -1;
+    }
+    // the buffer pool never trims on its hot path, this is what drives it
+    main_loop_.runEvery(1.0, [] { BufferMemoryPool::instance().trimIfDue(); });
     main_loop_.run();
 }
 
@@ -60,74 +97,302 @@ void TcpServer::stop(){
     running_ = false;
     main_loop_.stop();
     
-    for (auto& loop : loops_) {
+    for (auto loop : loops_) {
         loop->stop();
     }
     
-    threadpool_->shutdown();
+    if (threadpool_) threadpool_->shutdown();
+    // the loops lived on their threads' stacks, gone now ( closing their connections on the way )
+    loops_.clear();
     
-    // if (timeout_thread_.joinable()) timeout_thread_.join();
-    
-    close(listen_fd_);
+    if (timeout_thread_.joinable()) timeout_thread_.join();
 }
 
 
-void TcpServer::set_connection_callback(std::function<void(std::shared_ptr<TcpConnection>)> cb) {
+void TcpServer::set_connection_callback(ConnectionCallback cb) {
     connection_callback_ = cb;
 }
 
-void TcpServer::set_message_callback(typename TcpConnection::DataCallback cb) {
+void TcpServer::set_message_callback(MessageCallback cb) {
     message_callback_ = cb;
 }
 
-void TcpServer::handle_accept(int fd, uint32_t events) {
-    sockaddr_in client_addr{};
-    socklen_t addr_len = sizeof(client_addr);
+void TcpServer::set_read_data_callback(ReadDataCallback cb) {
+    read_data_callback_ = cb;
+}
+
+void TcpServer::set_write_complete_callback(WriteCompleteCallback cb) {
+    write_complete_callback_ = cb;
+}
+
+void TcpServer::set_high_water_mark_callback(HighWatermarkCallback cb) {
+    high_water_mark_callback_ = cb;
+}
+
+void TcpServer::set_water_marks(size_t high, size_t low) {
+    high_water_mark_ = high;
+    low_water_mark_ = std::min(low, high);
+}
+
+bool TcpServer::set_defer_accept(int seconds) {
+    if (listen_addr_.isUnix() || !listen_socket_.setDeferAccept(seconds)) return false;
+    read_on_accept_ = read_on_accept_ || seconds > 0;
+    return true;
+}
+
+bool TcpServer::set_fast_open(int queue_len) {
+    // no read on accept here: most clients send no data in the SYN, that read would
+    // just hit EAGAIN, the TFO payload shows up on the first epoll round anyway
+    return !listen_addr_.isUnix() && listen_socket_.setFastOpen(queue_len);
+}
+
+void TcpServer::set_overload_options(const OverloadOptions &options) {
+    overload_ = options;
+    accept_bucket_.reset(options.acceptRate, options.acceptBurst, Clock::steadyMicros());
+    // fds are handed out lowest first, so the fd number tracks how many are open
+    rlimit rl{};
+    fd_limit_ = 0;
+    if (options.fdHeadroom > 0 && ::getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY) {
+        fd_limit_ = static_cast<int>(rl.rlim_cur) - options.fdHeadroom;
+    }
+}
+
+void TcpServer::set_rate_limits(const RateLimit &read, const RateLimit &write) {
+    read_limit_ = read;
+    write_limit_ = write;
+}
+
+void TcpServer::set_peer_rate_limits(const RateLimit &read, const RateLimit &write) {
+    peer_rates_.clear();
+    if (!read.limited() && !write.limited()) return;
+    // every connection of a client lands on the same loop ( pick_loop ), so each
+    // loop's table can enforce the whole limit for the clients it owns
+    for (size_t i = 0; i < loops_.size(); ++i) {
+        peer_rates_.push_back(std::make_unique<PeerRateTable>(read, write));
+    }
+}
+
+void TcpServer::handle_accept(TimeStamp) {
+    InetAddress peer_addr;
     int conn_fd;
-    
-    while ((conn_fd = accept4(fd, (sockaddr*)&client_addr, &addr_len, SOCK_NONBLOCK)) != -1) {
-        if (conn_fd == -1) {
-            if (errno == EAGAIN || errno == EWOULDBLOCK) {
-                break; // 没有更多连接
-            } else {
-                perror("accept4");
-                continue;
+
+    // bounded, so timers on the accept loop ( pause, drain ) still get their turn under a flood
+    for (int i = 0; i < kMaxAcceptsPerEvent; ++i) {
+        Shed reason = admit();
+        if (reason != Shed::NONE && overload_.pauseAccept) {
+            // leave them in the backlog, the kernel pushes back once it is full
+            shed(reason);
+            pause_accept(reason == Shed::RATE
+                         ? std::max(overload_.pauseSeconds, accept_bucket_.microsUntil(1, main_loop_.steadyMicros()) / 1e6)
+                         : overload_.pauseSeconds);
+            return;
+        }
+
+        if ((conn_fd = listen_socket_.accept(&peer_addr)) < 0) {
+            if (errno == EMFILE || errno == ENFILE) {
+                if (drop_with_reserve_fd()) continue;
+                // no reserve either, level triggered accept would spin on the same error
+                pause_accept(overload_.pauseSeconds);
             }
+            return;
         }
+        if (reason == Shed::NONE && fd_limit_ > 0 && conn_fd >= fd_limit_) reason = Shed::FDS;
+        if (reason != Shed::NONE) {
+            // accept-and-close: the client learns at once instead of timing out in the backlog
+            ::close(conn_fd);
+            shed(reason);
+            continue;
+        }
+        EventLoop* loop = pick_loop(peer_addr);
+        accept_bucket_.tryTake(1, main_loop_.steadyMicros());
+        accept_stats_.accepted.fetch_add(1, std::memory_order_relaxed);
+        // counted here rather than on the io loop, so a burst cannot overshoot maxConnections
+        connection_count_.fetch_add(1, std::memory_order_relaxed);
+        LOG_EVERY_N(LogLevel::DEBUG, 1000) << "Accepted connection from " << peer_addr.toIpPort();
         
-        // 打印客户端信息
-        char ip_str[INET_ADDRSTRLEN];
-        inet_ntop(AF_INET, &client_addr.sin_addr, ip_str, sizeof(ip_str));
-        std::cout << "Accepted connection from " << ip_str 
-                    << ":" << ntohs(client_addr.sin_port) << std::endl;
-        
-        // 使用Round-Robin选择事件循环
-        EventLoop* loop = get_next_loop();
-        
-        // 创建TCP连接
-        auto conn = std::make_shared<TcpConnection>(conn_fd, loop);
-        conn->set_data_callback(message_callback_);
-        conn->set_close_callback([this](auto conn) {
-            handle_close(conn);
-        });
+        std::string name = peer_addr.toIpPort() + "#" + std::to_string(next_conn_id_++);
         
         // 添加到超时管理器
         timeout_manager_.add_connection(conn_fd);
-        
-        // 调用连接回调
-        if (connection_callback_) {
-            connection_callback_(conn);
+
+        // the connection is carved from the io loop's slab on that loop,
+        // no reference ever crosses threads
+        loop->runInLoop([this, loop, conn_fd, name, peer_addr] {
+            new_connection(loop, conn_fd, name, peer_addr);
+        });
+    }
+}
+
+TcpServer::Shed TcpServer::admit() {
+    if (overload_.maxConnections && connection_count_.load(std::memory_order_relaxed) >= overload_.maxConnections) {
+        return Shed::CONNECTIONS;
+    }
+    if (accept_bucket_.available(main_loop_.steadyMicros()) < 1) return Shed::RATE;
+    if (overload_.maxLoopLagMicros) {
+        for (EventLoop *loop : loops_) {
+            if (loop->lagMicros() <= overload_.maxLoopLagMicros) return Shed::NONE;
         }
-        
-        // 在事件循环中建立连接
-        conn->establish();
+        return Shed::LAG;
+    }
+    return Shed::NONE;
+}
+
+EventLoop* TcpServer::pick_loop(const InetAddress &peer_addr) {
+    if (!peer_rates_.empty() && !peer_addr.isUnix()) {
+        // per-client limits: pinned by ip, even to a lagging loop, the limit must hold
+        uint32_t ip = reinterpret_cast<const sockaddr_in*>(peer_addr.getSockAddr())->sin_addr.s_addr;
+        uint32_t h = ip * 2654435761u;     // Knuth multiplicative hash, spreads adjacent addresses
+        return loops_[h % loops_.size()];
+    }
+    // 使用Round-Robin选择事件循环, skipping loops that fell behind
+    EventLoop *loop = get_next_loop();
+    for (int tries = 1; overload_.maxLoopLagMicros && tries < io_thread_num_; ++tries) {
+        if (loop->lagMicros() <= overload_.maxLoopLagMicros) break;
+        loop = get_next_loop();
+    }
+    return loop;
+}
 
-        addr_len = sizeof(client_addr); // 重置长度
+void TcpServer::shed(Shed reason) {
+    switch (reason) {
+        case Shed::CONNECTIONS: accept_stats_.shedConnectionLimit.fetch_add(1, std::memory_order_relaxed); break;
+        case Shed::LAG:         accept_stats_.shedLag.fetch_add(1, std::memory_order_relaxed); break;
+        case Shed::RATE:        accept_stats_.shedRate.fetch_add(1, std::memory_order_relaxed); break;
+        case Shed::FDS:         accept_stats_.shedFds.fetch_add(1, std::memory_order_relaxed); break;
+        case Shed::NONE:        return;
     }
+    LOG_EVERY_T(LogLevel::WARN, 1.0) << "overloaded, shedding connections ( " << connection_count() << " open )";
+}
+
+void TcpServer::pause_accept(double seconds) {
+    if (accept_paused_ || draining_) return;
+    accept_paused_ = true;
+    accept_stats_.pauses.fetch_add(1, std::memory_order_relaxed);
+    accept_channel_.disableReading();
+    main_loop_.runAfter(seconds, [this] {
+        accept_paused_ = false;
+        if (!draining_) accept_channel_.enableReading();
+    });
 }
 
-void TcpServer::handle_close(std::shared_ptr<TcpConnection> conn) {
+bool TcpServer::drop_with_reserve_fd() {
+    accept_stats_.emfile.fetch_add(1, std::memory_order_relaxed);
+    if (reserve_fd_ < 0) return false;
+    ::close(reserve_fd_);
+    int fd = ::accept4(listen_socket_.fd(), nullptr, nullptr, SOCK_CLOEXEC);
+    if (fd >= 0) ::close(fd);
+    reserve_fd_ = ::open("/dev/null", O_RDONLY | O_CLOEXEC);
+    return fd >= 0;
+}
+
+void TcpServer::new_connection(EventLoop* loop, int conn_fd, const std::string &name, const InetAddress &peer_addr) {
+    TcpConnectionPtr conn = TcpConnection::create(loop, conn_fd, name, listen_addr_, peer_addr);
+    conn->setConnectionCallback(connection_callback_);
+    conn->setMessageCallback(message_callback_);
+    conn->setReadDataCallback(read_data_callback_);
+    conn->setWriteCompleteCallback(write_complete_callback_);
+    conn->setHighWaterMarkCallback(high_water_mark_callback_);
+    conn->setWaterMarks(high_water_mark_, low_water_mark_);
+    conn->setOutputBudget(&output_budget_);
+    conn->setReadBatch(read_batch_bytes_, read_batch_reads_);
+    conn->setBufferMemory(&buffer_memory_);
+    conn->setBufferReclaim(reclaim_keep_bytes_, reclaim_idle_seconds_);
+    if (read_limit_.limited() || write_limit_.limited()) conn->setRateLimits(read_limit_, write_limit_);
+    if (!peer_rates_.empty() && !peer_addr.isUnix()) {
+        size_t index = std::find(loops_.begin(), loops_.end(), loop) - loops_.begin();
+        conn->setPeerRateBuckets(peer_rates_[index]->acquire(peer_addr.toIp(), loop->steadyMicros()));
+    }
+    conn->setCloseCallback([this](TcpConnectionPtr conn) {
+        handle_close(conn);
+    });
+    // 在事件循环中建立连接, the loop keeps its own ref from here on
+    conn->establishConnection(read_on_accept_);
+}
+
+void TcpServer::handle_close(TcpConnectionPtr conn) {
     timeout_manager_.remove_connection(conn->fd());
+    connection_count_.fetch_sub(1, std::memory_order_relaxed);
+}
+
+int TcpServer::bind_or_inherit(const InetAddress &addr, int *upgrade_sock) {
+    int sock = upgrade::inheritedSocket();
+    if (sock >= 0) {
+        std::vector<int> fds;
+        std::string tag;
+        if (upgrade::recvFds(sock, &fds, &tag) && tag == "listen" && fds.size() == 1) {
+            LOG_INFO << "inherited listen fd " << fds[0] << " from the previous process";
+            *upgrade_sock = sock;
+            return fds[0];
+        }
+        for (int fd : fds) ::close(fd);
+        ::close(sock);
+        LOG_ERROR << "upgrade handoff failed, binding a new listen socket";
+    }
+    return create_and_bind(addr);
+}
+
+bool TcpServer::upgrade(const std::vector<std::string> &argv, std::function<void(bool)> done) {
+    if (draining_ || upgrading_.exchange(true)) return false;
+    int sock = -1;
+    pid_t pid = upgrade::spawn(argv, &sock);
+    // the accept queue lives in the socket, both processes share it from here on
+    if (pid < 0 || !upgrade::sendFds(sock, { listen_socket_.fd() }, "listen")) {
+        if (sock >= 0) ::close(sock);
+        LOG_ERROR << "upgrade: could not hand the listen socket to process " << pid << ", keep serving";
+        upgrading_ = false;
+        return false;
+    }
+    // the ack is awaited on the accept loop, accepting goes on meanwhile
+    main_loop_.runInLoop([this, sock, pid, done = std::move(done)] {
+        upgrade_pid_ = pid;
+        upgrade_done_ = std::move(done);
+        upgrade_channel_ = std::make_unique<Channel>(&main_loop_, sock);
+        // an ack byte, or EOF if the process died before taking over
+        upgrade_channel_->setReadCallBack([this, sock](TimeStamp) { finish_upgrade(upgrade::waitAck(sock, 0)); });
+        upgrade_channel_->setCloseCallBack([this] { finish_upgrade(false); });
+        upgrade_channel_->enableReading();
+        upgrade_timer_ = main_loop_.runAfter(10, [this] { finish_upgrade(false); });
+    });
+    return true;
+}
+
+void TcpServer::finish_upgrade(bool took_over) {
+    if (!upgrade_channel_) return;      // already decided
+    main_loop_.cancel(upgrade_timer_);
+    int sock = upgrade_channel_->fd();
+    upgrade_channel_->disableAll();
+    upgrade_channel_->remove();
+    // we may be inside the channel's own callback, free it after this event
+    Channel *channel = upgrade_channel_.release();
+    main_loop_.queueInLoop([channel, sock] {
+        delete channel;
+        ::close(sock);
+    });
+
+    if (took_over) {
+        LOG_INFO << "upgrade: process " << upgrade_pid_ << " accepting, draining " << connection_count() << " connections";
+        begin_drain();
+    } else {
+        LOG_ERROR << "upgrade: process " << upgrade_pid_ << " did not take over, keep serving";
+        upgrading_ = false;
+    }
+    auto done = std::move(upgrade_done_);
+    upgrade_done_ = nullptr;
+    if (done) done(took_over);
+}
+
+void TcpServer::begin_drain() {
+    accept_channel_.disableAll();
+    accept_channel_.remove();
+    drain_deadline_ = main_loop_.steadyMicros() + int64_t(drain_timeout_seconds_) * 1000000;
+    draining_ = true;
+    // polled on the accept loop, start() returns within one period of the last close
+    main_loop_.runEvery(0.01, [this] {
+        if (connection_count_ == 0 || main_loop_.steadyMicros() >= drain_deadline_) {
+            LOG_INFO << "drain finished, " << connection_count_.load() << " connections left";
+            main_loop_.stop();
+        }
+    });
 }
 
 void TcpServer::handle_timeout(int fd) {
@@ -140,5 +405,5 @@ void TcpServer::handle_timeout(int fd) {
 EventLoop* TcpServer::get_next_loop() {
     // Round-Robin算法选择事件循环
     int index = next_loop_index_.fetch_add(1) % io_thread_num_;
-    return loops_[index].get();
-}
\ No newline at end of file
+    return loops_[index];
+}
@@ -0,0 +1,91 @@
+#include "timerqueue.h"
+#include "eventloop.h"
+#include "clock.h"
+#include "logger.h"
+
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <sys/timerfd.h>
+
+static int createTimerFd(){
+    int fd = ::timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if(fd < 0){
+        LOG_ERROR << "timerfd_create() failed: " << strerror(errno);
+    }
+    return fd;
+}
+
+TimerQueue::TimerQueue(EventLoop *loop)
+    : loop_(loop)
+    , timerfd_(createTimerFd())
+    , channel_(loop, timerfd_) {
+    channel_.setReadCallBack([this](TimeStamp) { handleRead(); });
+    channel_.enableReading();
+}
+
+TimerQueue::~TimerQueue(){
+    channel_.disableAll();
+    channel_.remove();
+    ::close(timerfd_);
+}
+
+void TimerQueue::add(TimerId id, int64_t when, int64_t interval, Callback cb){
+    timers_.emplace(id, Timer{ std::move(cb), interval });
+    heap_.push(Entry{ when, id });
+    if(armedAt_ == 0 || when < armedAt_) rearm();
+}
+
+void TimerQueue::cancel(TimerId id){
+    timers_.erase(id);
+}
+
+void TimerQueue::handleRead(){
+    uint64_t expirations;
+    if(::read(timerfd_, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN){
+        LOG_EVERY_T(LogLevel::ERROR, 1.0) << "timerfd read failed: " << strerror(errno);
+    }
+    armedAt_ = 0;
+
+    // the loop refreshed its clock just before dispatching us
+    int64_t now = LoopClock::steadyMicros();
+    while(!heap_.empty() && heap_.top().when <= now){
+        Entry e = heap_.top();
+        heap_.pop();
+        auto it = timers_.find(e.id);
+        if(it == timers_.end()) continue;       // cancelled
+
+        if(it->second.interval > 0){
+            heap_.push(Entry{ e.when + it->second.interval, e.id });
+            Callback cb = it->second.cb;        // the callback may cancel itself
+            cb();
+        }else{
+            Callback cb = std::move(it->second.cb);
+            timers_.erase(it);
+            cb();
+        }
+    }
+    rearm();
+}
+
+void TimerQueue::rearm(){
+    // drop cancelled entries so they do not cause empty wakeups
+    while(!heap_.empty() && !timers_.count(heap_.top().id)) heap_.pop();
+
+    itimerspec spec{};
+    if(!heap_.empty()){
+        int64_t when = heap_.top().when;
+        if(when == armedAt_) return;
+        // absolute CLOCK_MONOTONIC, a deadline already passed fires at once
+        when = std::max<int64_t>(when, 1);
+        spec.it_value.tv_sec = when / 1000000;
+        spec.it_value.tv_nsec = (when % 1000000) * 1000;
+        armedAt_ = heap_.top().when;
+    }else{
+        if(armedAt_ == 0) return;
+        armedAt_ = 0;       // all zero disarms
+    }
+    if(::timerfd_settime(timerfd_, TFD_TIMER_ABSTIME, &spec, nullptr) < 0){
+        LOG_EVERY_T(LogLevel::ERROR, 1.0) << "timerfd_settime() failed: " << strerror(errno);
+    }
+}
@@ -0,0 +1,353 @@
+#include "udpserver.h"
+#include "logger.h"
+
+#include <future>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <system_error>
+
+#ifndef SOL_UDP
+#define SOL_UDP 17
+#endif
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+#ifndef UDP_GRO
+#define UDP_GRO 104
+#endif
+
+namespace {
+    constexpr size_t kGroSlotSize = 64 * 1024;
+    constexpr size_t kMaxGsoSegments = 64;      // kernel limit UDP_MAX_SEGMENTS
+    constexpr size_t kMaxGsoBytes = 65000;      // stay under the ip payload limit
+    constexpr int kMaxReadRounds = 8;           // recvmmsg calls per readable event, keeps loops fair
+    constexpr size_t kControlSize = CMSG_SPACE(sizeof(int));
+}
+
+UdpChannel::UdpChannel(EventLoop *loop, int fd, const Options &options, DatagramCallback cb, Stats *stats)
+    : loop_(loop)
+    , socket_(fd)
+    , channel_(loop, fd)
+    , options_(options)
+    , callback_(std::move(cb))
+    , slotSize_(options.gro ? kGroSlotSize : options.maxDatagramSize)
+    , stats_(stats ? stats : &ownStats_) {
+
+    recvBuffers_.reserve(kBatch);
+    for (size_t i = 0; i < kBatch; ++i) {
+        recvBuffers_.push_back(BufferMemoryPool::instance().acquire(slotSize_));
+    }
+    recvMsgs_.resize(kBatch);
+    recvIov_.resize(kBatch);
+    recvAddrs_.resize(kBatch);
+    recvControl_.resize(kBatch * kControlSize);
+
+    // every pointer is fixed here, a read only resets the lengths
+    for (size_t i = 0; i < kBatch; ++i) {
+        recvIov_[i].iov_base = recvBuffers_[i]->data();
+        recvIov_[i].iov_len = slotSize_;
+        msghdr &h = recvMsgs_[i].msg_hdr;
+        h.msg_iov = &recvIov_[i];
+        h.msg_iovlen = 1;
+        h.msg_name = &recvAddrs_[i];
+    }
+
+    // sizes never change, so the pointers into these stay valid
+    sendQueue_.reserve(kMaxQueued);
+    sendMsgs_.resize(kBatch);
+    sendIov_.resize(kMaxQueued);
+    sendControl_.resize(kBatch * CMSG_SPACE(sizeof(uint16_t)));
+
+    channel_.setReadCallBack([this](TimeStamp ts) { handleRead(ts); });
+    channel_.setWriteCallBack([this] { handleWrite(); });
+}
+
+UdpChannel::~UdpChannel() {
+    if (loop_->hasChannel(&channel_)) {
+        channel_.disableAll();
+        channel_.remove();
+    }
+}
+
+void UdpChannel::start() {
+    channel_.enableReading();
+}
+
+void UdpChannel::handleRead(TimeStamp ts) {
+    inReadBatch_ = true;
+    for (int round = 0; round < kMaxReadRounds; ++round) {
+        for (size_t i = 0; i < kBatch; ++i) {
+            msghdr &h = recvMsgs_[i].msg_hdr;
+            h.msg_namelen = sizeof(sockaddr_storage);
+            h.msg_control = options_.gro ? &recvControl_[i * kControlSize] : nullptr;
+            h.msg_controllen = options_.gro ? kControlSize : 0;
+            h.msg_flags = 0;
+        }
+        int n = ::recvmmsg(socket_.fd(), recvMsgs_.data(), kBatch, MSG_DONTWAIT, nullptr);
+        stats_->recvSyscalls.fetch_add(1, std::memory_order_relaxed);
+        if (n <= 0) {
+            if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                LOG_EVERY_T(LogLevel::ERROR, 1.0) << "recvmmsg() failed: " << strerror(errno);
+            }
+            break;
+        }
+
+        size_t truncated = 0;
+        InetAddress peer;
+        for (int i = 0; i < n; ++i) {
+            const msghdr &h = recvMsgs_[i].msg_hdr;
+            if (h.msg_flags & MSG_TRUNC) {
+                ++truncated;
+                continue;
+            }
+            size_t segment = 0;
+            if (options_.gro) {
+                for (cmsghdr *c = CMSG_FIRSTHDR(&h); c; c = CMSG_NXTHDR(const_cast<msghdr*>(&h), c)) {
+                    if (c->cmsg_level == SOL_UDP && c->cmsg_type == UDP_GRO) {
+                        int gso;
+                        std::memcpy(&gso, CMSG_DATA(c), sizeof(gso));
+                        segment = static_cast<size_t>(gso);
+                    }
+                }
+            }
+            peer.setSockAddr(static_cast<const sockaddr*>(h.msg_name), h.msg_namelen);
+            deliver(static_cast<const char*>(recvIov_[i].iov_base), recvMsgs_[i].msg_len, segment, peer, ts);
+        }
+        if (truncated) stats_->truncated.fetch_add(truncated, std::memory_order_relaxed);
+
+        if (static_cast<size_t>(n) < kBatch) break;     // drained
+    }
+    inReadBatch_ = false;
+    flush();
+}
+
+// a gro message is several datagrams of `segment` bytes, the last one may be shorter
+void UdpChannel::deliver(const char *data, size_t len, size_t segment, const InetAddress &peer, TimeStamp ts) {
+    if (segment == 0 || segment >= len) {
+        stats_->received.fetch_add(1, std::memory_order_relaxed);
+        if (callback_) callback_(this, data, len, peer, ts);
+        return;
+    }
+    size_t count = 0;
+    for (size_t off = 0; off < len; off += segment, ++count) {
+        if (callback_) callback_(this, data + off, std::min(segment, len - off), peer, ts);
+    }
+    stats_->received.fetch_add(count, std::memory_order_relaxed);
+}
+
+void UdpChannel::send(const InetAddress &peer, const char *data, size_t len) {
+    if (sendQueue_.size() == kMaxQueued) {
+        flush();
+        if (sendQueue_.size() == kMaxQueued) {
+            stats_->dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+    }
+    PooledBuffer buf = BufferMemoryPool::instance().acquire(len);
+    if (!buf) {
+        stats_->dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    buf->append(data, len);
+    sendQueue_.push_back(Outgoing{ std::move(buf), peer });
+
+    // outside a read batch nobody flushes for us, once per iteration is enough
+    if (!inReadBatch_ && !flushQueued_) {
+        flushQueued_ = true;
+        loop_->queueInLoop([this] {
+            flushQueued_ = false;
+            flush();
+        });
+    }
+}
+
+size_t UdpChannel::buildSendBatch(size_t from, size_t *consumed) {
+    size_t msgs = 0;
+    size_t i = from;
+    char *control = sendControl_.data();
+    while (i < sendQueue_.size() && msgs < kBatch) {
+        const Outgoing &first = sendQueue_[i];
+        size_t segment = first.buf->readableBytes();
+        size_t j = i + 1;
+        size_t total = segment;
+        if (options_.gso) {
+            // equal-sized datagrams to the same peer, a shorter one may close the run
+            while (j < sendQueue_.size() && j - i < kMaxGsoSegments) {
+                const Outgoing &next = sendQueue_[j];
+                size_t len = next.buf->readableBytes();
+                if (len > segment || total + len > kMaxGsoBytes) break;
+                if (next.peer.getSockLen() != first.peer.getSockLen()
+                    || std::memcmp(next.peer.getSockAddr(), first.peer.getSockAddr(), first.peer.getSockLen()) != 0) break;
+                total += len;
+                ++j;
+                if (len < segment) break;
+            }
+        }
+
+        for (size_t k = i; k < j; ++k) {
+            sendIov_[k].iov_base = const_cast<char*>(sendQueue_[k].buf->readPtr());
+            sendIov_[k].iov_len = sendQueue_[k].buf->readableBytes();
+        }
+        mmsghdr &m = sendMsgs_[msgs];
+        std::memset(&m, 0, sizeof(m));
+        m.msg_hdr.msg_name = const_cast<sockaddr*>(first.peer.getSockAddr());
+        m.msg_hdr.msg_namelen = first.peer.getSockLen();
+        m.msg_hdr.msg_iov = &sendIov_[i];
+        m.msg_hdr.msg_iovlen = j - i;
+        if (j - i > 1) {
+            char *ctl = control + msgs * CMSG_SPACE(sizeof(uint16_t));
+            m.msg_hdr.msg_control = ctl;
+            m.msg_hdr.msg_controllen = CMSG_SPACE(sizeof(uint16_t));
+            cmsghdr *c = CMSG_FIRSTHDR(&m.msg_hdr);
+            c->cmsg_level = SOL_UDP;
+            c->cmsg_type = UDP_SEGMENT;
+            c->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+            uint16_t seg = static_cast<uint16_t>(segment);
+            std::memcpy(CMSG_DATA(c), &seg, sizeof(seg));
+        }
+        consumed[msgs] = j - i;
+        ++msgs;
+        i = j;
+    }
+    return msgs;
+}
+
+void UdpChannel::flush() {
+    size_t done = 0;
+    size_t consumed[kBatch];
+    while (done < sendQueue_.size()) {
+        size_t msgs = buildSendBatch(done, consumed);
+        int n = ::sendmmsg(socket_.fd(), sendMsgs_.data(), static_cast<unsigned>(msgs), MSG_DONTWAIT);
+        stats_->sendSyscalls.fetch_add(1, std::memory_order_relaxed);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                // socket buffer full, keep the rest and wait for room
+                if (!channel_.isWriting()) channel_.enableWriting();
+                break;
+            }
+            if (errno == EINTR) continue;
+            if (options_.gso && consumed[0] > 1 && (errno == EIO || errno == EINVAL)) {
+                // no gso on this route / nic, fall back to one datagram per message
+                LOG_WARN << "UDP_SEGMENT rejected (" << strerror(errno) << "), disabling gso";
+                options_.gso = false;
+                continue;
+            }
+            // this message is undeliverable ( e.g. ECONNREFUSED from an icmp error ), skip it
+            LOG_EVERY_T(LogLevel::ERROR, 1.0) << "sendmmsg() failed: " << strerror(errno);
+            stats_->dropped.fetch_add(consumed[0], std::memory_order_relaxed);
+            done += consumed[0];
+            continue;
+        }
+        size_t datagrams = 0;
+        for (int k = 0; k < n; ++k) datagrams += consumed[k];
+        stats_->sent.fetch_add(datagrams, std::memory_order_relaxed);
+        done += datagrams;
+    }
+
+    // sent buffers go back to the pool here
+    sendQueue_.erase(sendQueue_.begin(), sendQueue_.begin() + static_cast<std::ptrdiff_t>(done));
+    if (sendQueue_.empty() && channel_.isWriting()) channel_.disableWriting();
+}
+
+void UdpChannel::handleWrite() {
+    flush();
+}
+
+
+UdpServer::UdpServer(const InetAddress &addr, int thread_num, const Options &options)
+    : addr_(addr)
+    , options_(options) {
+    int shards = std::max(1, thread_num);
+    for (int i = 0; i < shards; ++i) {
+        fds_.push_back(create_udp_socket(addr_, options_));
+        stats_.push_back(std::make_unique<UdpChannel::Stats>());
+    }
+}
+
+UdpServer::~UdpServer() {
+    stop();
+    for (int fd : fds_) {
+        if (fd >= 0) ::close(fd);
+    }
+}
+
+int UdpServer::create_udp_socket(const InetAddress &addr, const Options &options) {
+    int fd = ::socket(addr.family(), SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) throw std::system_error(errno, std::system_category(), "udp socket creation failed");
+
+    int on = 1;
+    // every shard binds the same address, the kernel hashes flows across them
+    if (!addr.isUnix() && ::setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) < 0) {
+        ::close(fd);
+        throw std::system_error(errno, std::system_category(), "setsockopt SO_REUSEPORT failed");
+    }
+    if (options.recvBufferBytes > 0) {
+        ::setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &options.recvBufferBytes, sizeof(options.recvBufferBytes));
+    }
+    if (options.sendBufferBytes > 0) {
+        ::setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &options.sendBufferBytes, sizeof(options.sendBufferBytes));
+    }
+    if (options.gro && ::setsockopt(fd, SOL_UDP, UDP_GRO, &on, sizeof(on)) < 0) {
+        LOG_WARN << "UDP_GRO not supported: " << strerror(errno);
+    }
+    if (::bind(fd, addr.getSockAddr(), addr.getSockLen()) < 0) {
+        ::close(fd);
+        throw std::system_error(errno, std::system_category(), "udp bind failed");
+    }
+    return fd;
+}
+
+void UdpServer::start() {
+    // the other shards, each loop and channel live on their worker's stack
+    int shards = static_cast<int>(fds_.size());
+    if (shards > 1) threadpool_ = std::make_unique<ThreadPool>(shards - 1);
+    for (int i = 1; i < shards; ++i) {
+        int fd = fds_[i];
+        fds_[i] = -1;
+        UdpChannel::Stats *stats = stats_[i].get();
+        auto ready = std::make_shared<std::promise<EventLoop*>>();
+        auto loop_future = ready->get_future();
+        threadpool_->enqueue([this, ready, fd, stats] {
+            EventLoop loop;
+            UdpChannel channel(&loop, fd, options_, callback_, stats);
+            channel.start();
+            ready->set_value(&loop);
+            loop.run();
+        });
+        loops_.push_back(loop_future.get());
+    }
+
+    main_channel_ = std::make_unique<UdpChannel>(&main_loop_, fds_[0], options_, callback_, stats_[0].get());
+    fds_[0] = -1;
+    main_channel_->start();
+    main_loop_.runEvery(1.0, [] { BufferMemoryPool::instance().trimIfDue(); });
+    main_loop_.run();
+}
+
+void UdpServer::stop() {
+    main_loop_.stop();
+    for (auto loop : loops_) loop->stop();
+    if (threadpool_) threadpool_->shutdown();
+    loops_.clear();
+}
+
+uint64_t UdpServer::received() const {
+    uint64_t n = 0;
+    for (auto &s : stats_) n += s->received.load(std::memory_order_relaxed);
+    return n;
+}
+
+uint64_t UdpServer::sent() const {
+    uint64_t n = 0;
+    for (auto &s : stats_) n += s->sent.load(std::memory_order_relaxed);
+    return n;
+}
+
+uint64_t UdpServer::dropped() const {
+    uint64_t n = 0;
+    for (auto &s : stats_) n += s->dropped.load(std::memory_order_relaxed) + s->truncated.load(std::memory_order_relaxed);
+    return n;
+}
@@ -0,0 +1,149 @@
+#include "upgrade.h"
+#include "logger.h"
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+extern char **environ;
+
+namespace upgrade {
+
+pid_t spawn(const std::vector<std::string> &argv, int *sock) {
+    if (argv.empty()) return -1;
+
+    int pair[2];
+    // our end closes on exec, the child's end must survive it
+    if (::socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, pair) < 0) {
+        LOG_ERROR << "upgrade socketpair() failed: " << strerror(errno);
+        return -1;
+    }
+
+    // everything execve needs is built before fork, the child only calls async-signal-safe functions
+    std::vector<std::string> env;
+    std::string inherit = std::string(kInheritEnv) + "=" + std::to_string(pair[1]);
+    size_t prefix = std::strlen(kInheritEnv) + 1;
+    for (char **e = environ; e && *e; ++e) {
+        if (std::strncmp(*e, inherit.c_str(), prefix) != 0) env.emplace_back(*e);
+    }
+    env.push_back(inherit);
+
+    std::vector<char*> cargv, cenv;
+    for (auto &a : argv) cargv.push_back(const_cast<char*>(a.c_str()));
+    cargv.push_back(nullptr);
+    for (auto &e : env) cenv.push_back(const_cast<char*>(e.c_str()));
+    cenv.push_back(nullptr);
+
+    pid_t pid = ::fork();
+    if (pid < 0) {
+        LOG_ERROR << "upgrade fork() failed: " << strerror(errno);
+        ::close(pair[0]);
+        ::close(pair[1]);
+        return -1;
+    }
+    if (pid == 0) {
+        ::fcntl(pair[1], F_SETFD, 0);   // drop FD_CLOEXEC
+        ::execve(cargv[0], cargv.data(), cenv.data());
+        ::_exit(127);
+    }
+
+    ::close(pair[1]);
+    *sock = pair[0];
+    return pid;
+}
+
+int inheritedSocket() {
+    const char *v = ::getenv(kInheritEnv);
+    if (!v || !*v) return -1;
+    int fd = std::atoi(v);
+    ::unsetenv(kInheritEnv);    // do not leak into our own children
+    ::fcntl(fd, F_SETFD, FD_CLOEXEC);
+    return fd;
+}
+
+bool sendFds(int sock, const std::vector<int> &fds, const std::string &payload) {
+    // at least one byte of real data has to go along with the ancillary data
+    char dummy = 0;
+    iovec iov{};
+    iov.iov_base = payload.empty() ? &dummy : const_cast<char*>(payload.data());
+    iov.iov_len = payload.empty() ? 1 : payload.size();
+
+    std::vector<char> control(CMSG_SPACE(sizeof(int) * fds.size()));
+    msghdr msg{};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    if (!fds.empty()) {
+        msg.msg_control = control.data();
+        msg.msg_controllen = control.size();
+        cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int) * fds.size());
+        std::memcpy(CMSG_DATA(cmsg), fds.data(), sizeof(int) * fds.size());
+    }
+
+    ssize_t n;
+    do {
+        n = ::sendmsg(sock, &msg, MSG_NOSIGNAL);
+    } while (n < 0 && errno == EINTR);
+    if (n != static_cast<ssize_t>(iov.iov_len)) {
+        LOG_ERROR << "upgrade sendmsg() failed: " << strerror(errno);
+        return false;
+    }
+    return true;
+}
+
+bool recvFds(int sock, std::vector<int> *fds, std::string *payload, size_t maxFds) {
+    char data[4096];
+    iovec iov{ data, sizeof(data) };
+    std::vector<char> control(CMSG_SPACE(sizeof(int) * maxFds));
+    msghdr msg{};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.data();
+    msg.msg_controllen = control.size();
+
+    ssize_t n;
+    do {
+        n = ::recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+    } while (n < 0 && errno == EINTR);
+    if (n <= 0) {
+        LOG_ERROR << "upgrade recvmsg() failed: " << (n == 0 ? "peer closed" : strerror(errno));
+        return false;
+    }
+
+    for (cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) continue;
+        size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        const int *p = reinterpret_cast<const int*>(CMSG_DATA(cmsg));
+        fds->insert(fds->end(), p, p + count);
+    }
+    if (msg.msg_flags & MSG_CTRUNC) {
+        LOG_ERROR << "upgrade recvmsg() truncated fds, more than " << maxFds;
+    }
+    if (payload) payload->assign(data, static_cast<size_t>(n));
+    return true;
+}
+
+bool waitAck(int sock, int timeoutMs) {
+    pollfd pfd{ sock, POLLIN, 0 };
+    int r;
+    do {
+        r = ::poll(&pfd, 1, timeoutMs);
+    } while (r < 0 && errno == EINTR);
+    if (r <= 0) return false;
+    char ack;
+    return ::read(sock, &ack, 1) == 1;
+}
+
+bool sendAck(int sock) {
+    char ack = 1;
+    return ::send(sock, &ack, 1, MSG_NOSIGNAL) == 1;
+}
+
+} // namespace upgrade
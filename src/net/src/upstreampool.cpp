@@ -0,0 +1,154 @@
+#include "upstreampool.h"
+#include "eventloop.h"
+#include "logger.h"
+
+#include <algorithm>
+#include <cstring>
+#include <sys/socket.h>
+
+UpstreamPool::UpstreamPool(EventLoop *loop, const InetAddress &serverAddr, const std::string &name,
+                           size_t maxConnections, size_t maxIdle)
+    : loop_(loop)
+    , serverAddr_(serverAddr)
+    , name_(name)
+    , maxConnections_(std::max<size_t>(maxConnections, 1))
+    , maxIdle_(maxIdle) {}
+
+UpstreamPool::~UpstreamPool(){
+    for(auto &conn : idle_){
+        conn->setCloseCallback(CloseCallback());
+        conn->forceClose();
+    }
+    // borrowed connections keep running, but must not report back to us
+    for(auto &conn : borrowed_) conn->setCloseCallback(CloseCallback());
+    for(auto &w : waiters_){
+        if(w.timer) loop_->cancel(w.timer);
+    }
+}
+
+void UpstreamPool::warmUp(size_t count){
+    // counted up front, a connect failing right away gives its slot back
+    size_t target = std::min(count, maxConnections_);
+    for(size_t n = total_; n < target; ++n) startConnect();
+}
+
+void UpstreamPool::acquire(AcquireCallback cb){
+    while(!idle_.empty()){
+        TcpConnectionPtr conn = std::move(idle_.back());
+        idle_.pop_back();
+        if(conn->connected()){
+            lend(conn, cb);
+            return;
+        }
+    }
+    uint64_t id = nextWaiterId_++;
+    TimerId timer = acquireTimeout_ > 0 ? loop_->runAfter(acquireTimeout_, [this, id]{ expire(id); }) : 0;
+    waiters_.push_back({ id, timer, std::move(cb) });
+    // one connect per waiter not already covered by an attempt in flight
+    if(waiters_.size() > connectors_.size() && total_ < maxConnections_) startConnect();
+}
+
+void UpstreamPool::release(const TcpConnectionPtr &conn){
+    auto it = std::find(borrowed_.begin(), borrowed_.end(), conn);
+    if(it == borrowed_.end()) return;   // not ours, or released twice
+    borrowed_.erase(it);
+    if(!conn->connected()) return;      // removeConnection does the bookkeeping
+    if(!waiters_.empty() || idle_.size() < maxIdle_){
+        dispatch(conn);
+    }else{
+        // ours no longer: it must not report its close to us, count it out now
+        forget(conn);
+        conn->shutdown();
+    }
+}
+
+void UpstreamPool::dispatch(const TcpConnectionPtr &conn){
+    if(!waiters_.empty()){
+        Waiter w = std::move(waiters_.front());
+        waiters_.pop_front();
+        if(w.timer) loop_->cancel(w.timer);
+        lend(conn, w.cb);
+    }else{
+        idle_.push_back(conn);
+    }
+}
+
+void UpstreamPool::lend(const TcpConnectionPtr &conn, AcquireCallback &cb){
+    borrowed_.push_back(conn);
+    cb(conn);
+}
+
+void UpstreamPool::expire(uint64_t waiterId){
+    auto it = std::find_if(waiters_.begin(), waiters_.end(), [waiterId](const Waiter &w){ return w.id == waiterId; });
+    if(it == waiters_.end()) return;
+    AcquireCallback cb = std::move(it->cb);
+    waiters_.erase(it);
+    LOG_EVERY_T(LogLevel::WARN, 1.0) << "UpstreamPool " << name_ << " acquire timed out after " << acquireTimeout_ << "s";
+    cb(TcpConnectionPtr());
+}
+
+void UpstreamPool::forget(const TcpConnectionPtr &conn){
+    conn->setCloseCallback(CloseCallback());
+    --total_;
+}
+
+void UpstreamPool::startConnect(){
+    ++total_;
+    auto connector = std::make_unique<Connector>(loop_, serverAddr_);
+    connector->setRetryDelay(initialDelay_, maxDelay_);
+    Connector *raw = connector.get();
+    connector->setNewConnectionCallback([this, raw](int sockfd){ newConnection(raw, sockfd); });
+    connector->setConnectFailedCallback([this, raw](int err){ connectFailed(raw, err); });
+    connectors_.push_back(std::move(connector));
+    raw->start();
+}
+
+void UpstreamPool::dropConnector(Connector *connector){
+    auto it = std::find_if(connectors_.begin(), connectors_.end(),
+                           [connector](const std::unique_ptr<Connector> &c){ return c.get() == connector; });
+    if(it != connectors_.end()){
+        loop_->queueInLoop([done = std::shared_ptr<Connector>(std::move(*it))]{});
+        connectors_.erase(it);
+    }
+}
+
+void UpstreamPool::connectFailed(Connector *connector, int err){
+    dropConnector(connector);
+    --total_;
+    // the attempt was made for the oldest waiter not covered by another one in flight
+    if(waiters_.size() > connectors_.size()){
+        Waiter w = std::move(waiters_.front());
+        waiters_.pop_front();
+        if(w.timer) loop_->cancel(w.timer);
+        LOG_WARN << "UpstreamPool " << name_ << " cannot connect: " << strerror(err);
+        w.cb(TcpConnectionPtr());
+    }
+}
+
+void UpstreamPool::newConnection(Connector *connector, int sockfd){
+    dropConnector(connector);
+
+    sockaddr_storage local{};
+    socklen_t len = sizeof(local);
+    ::getsockname(sockfd, reinterpret_cast<sockaddr*>(&local), &len);
+    InetAddress localAddr;
+    localAddr.setSockAddr(reinterpret_cast<sockaddr*>(&local), len);
+
+    std::string name = name_ + "#" + std::to_string(nextConnId_++);
+    TcpConnectionPtr conn = TcpConnection::create(loop_, sockfd, name, localAddr, serverAddr_);
+    conn->setConnectionCallback(connectionCallback_);
+    conn->setMessageCallback(messageCallback_);
+    conn->setCloseCallback([this](TcpConnectionPtr c){ removeConnection(c); });
+    conn->establishConnection();
+    dispatch(conn);
+}
+
+void UpstreamPool::removeConnection(const TcpConnectionPtr &conn){
+    --total_;
+    auto it = std::find(idle_.begin(), idle_.end(), conn);
+    if(it != idle_.end()) idle_.erase(it);
+    it = std::find(borrowed_.begin(), borrowed_.end(), conn);
+    if(it != borrowed_.end()) borrowed_.erase(it);
+    // still somebody waiting and nothing on the way for them
+    if(waiters_.size() > connectors_.size() && total_ < maxConnections_) startConnect();
+}
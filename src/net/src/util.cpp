@@ -2,6 +2,8 @@
 #include <fcntl.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <sys/un.h>
+#include <sys/stat.h>
 #include <arpa/inet.h>
 #include <unistd.h>
 #include <system_error>
@@ -18,34 +20,49 @@ void set_nonblocking(int fd) {
     }
 }
 
+// unlink path only if it is a socket nobody listens on any more,
+// anything else ( a live server, a regular file ) is left for bind to report
+static void remove_stale_unix_socket(const InetAddress &addr) {
+    const sockaddr_un *un = reinterpret_cast<const sockaddr_un*>(addr.getSockAddr());
+    if (un->sun_path[0] == '\0') return;
+    struct stat st;
+    if (::lstat(un->sun_path, &st) != 0 || !S_ISSOCK(st.st_mode)) return;
+
+    int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (probe == -1) return;
+    // non-blocking: a full backlog says EAGAIN, which still means someone is there
+    bool stale = ::connect(probe, addr.getSockAddr(), addr.getSockLen()) == -1 && errno == ECONNREFUSED;
+    close(probe);
+    if (stale) ::unlink(un->sun_path);
+}
+
 // create a fd, bind with an address, listen on it, return to caller
 int create_and_bind(const char* ip, int port) {
+    return create_and_bind(InetAddress(ip ? std::string(ip) : std::string("0.0.0.0"), static_cast<uint16_t>(port)));
+}
+
+int create_and_bind(const InetAddress &addr) {
 
-    int listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    int listen_fd = socket(addr.family(), SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    // CLOEXEC: an upgraded binary gets the fd explicitly, never by accident
     if (listen_fd == -1) {
         throw std::system_error(errno, std::system_category(), "socket creation failed");
     }
 
-    // 设置SO_REUSEADDR
-    int opt = 1;
-    if (setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) == -1) {
-        close(listen_fd);
-        throw std::system_error(errno, std::system_category(), "setsockopt SO_REUSEADDR failed");
-    }
-
-    sockaddr_in server_addr{};
-    server_addr.sin_family = AF_INET;
-    // host to network short
-    server_addr.sin_port = htons(port);
-    
-    if (ip == nullptr || strcmp(ip, "0.0.0.0") == 0) {
-        server_addr.sin_addr.s_addr = INADDR_ANY;
+    if (addr.isUnix()) {
+        // a filesystem socket left behind by a previous run makes bind fail with EADDRINUSE,
+        // abstract names vanish with their last socket
+        remove_stale_unix_socket(addr);
     } else {
-        // presentation (string) to network (uint32_t)
-        inet_pton(AF_INET, ip, &server_addr.sin_addr);
+        // 设置SO_REUSEADDR
+        int opt = 1;
+        if (setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) == -1) {
+            close(listen_fd);
+            throw std::system_error(errno, std::system_category(), "setsockopt SO_REUSEADDR failed");
+        }
     }
 
-    if (bind(listen_fd, (sockaddr*)&server_addr, sizeof(server_addr)) == -1) {
+    if (bind(listen_fd, addr.getSockAddr(), addr.getSockLen()) == -1) {
         close(listen_fd);
         throw std::system_error(errno, std::system_category(), "bind failed");
     }
@@ -57,4 +74,4 @@ int create_and_bind(const char* ip, int port) {
     }
 
     return listen_fd;
-}
\ No newline at end of file
+}
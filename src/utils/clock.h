@@ -0,0 +1,115 @@
+#pragma once
+
+#include "timestamp.h"
+
+#include <cstdint>
+#include <ctime>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#include <cpuid.h>
+#define CLOCK_HAS_TSC 1
+#endif
+
+/**
+ * clock sources
+ *  - Clock::steadyNanos / steadyMicros: CLOCK_MONOTONIC, for durations and deadlines,
+ *    never jumps with ntp or settimeofday
+ *  - LoopClock: per-thread cache refreshed once per eventloop iteration,
+ *    timers, idle timeouts and latency stamps read it instead of the clock
+ *  - Tsc: raw rdtsc calibrated against CLOCK_MONOTONIC, a few ns per read,
+ *    for instrumentation only, falls back to the steady clock without an invariant tsc
+ */
+namespace Clock {
+
+    inline int64_t steadyNanos() {
+        timespec ts;
+        ::clock_gettime(CLOCK_MONOTONIC, &ts);
+        return static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+    }
+
+    inline int64_t steadyMicros() { return steadyNanos() / 1000; }
+
+} // namespace Clock
+
+
+// wall and steady time as of the start of the current loop iteration
+class LoopClock {
+public:
+    // called by EventLoop right after epoll_wait returns
+    static void refresh() {
+        Cache &c = cache();
+        c.wall = TimeStamp::now();
+        c.steadyMicros = Clock::steadyMicros();
+    }
+
+    // cached values, off a loop thread ( never refreshed ) they read the clock
+    static TimeStamp now() {
+        const Cache &c = cache();
+        return c.steadyMicros ? c.wall : TimeStamp::now();
+    }
+
+    static int64_t steadyMicros() {
+        const Cache &c = cache();
+        return c.steadyMicros ? c.steadyMicros : Clock::steadyMicros();
+    }
+
+private:
+    struct Cache {
+        TimeStamp wall;
+        int64_t steadyMicros = 0;
+    };
+
+    static Cache& cache() {
+        thread_local Cache c;
+        return c;
+    }
+};
+
+
+class Tsc {
+public:
+    // invariant tsc: constant rate across p-states and synchronized between cores
+    static bool available() { return calibration().nsPerTick > 0; }
+
+    static uint64_t ticks() {
+#ifdef CLOCK_HAS_TSC
+        if (available()) return __rdtsc();
+#endif
+        return static_cast<uint64_t>(Clock::steadyNanos());
+    }
+
+    // converts a difference of ticks()
+    static int64_t toNanos(uint64_t ticks) {
+        double r = calibration().nsPerTick;
+        return r > 0 ? static_cast<int64_t>(static_cast<double>(ticks) * r) : static_cast<int64_t>(ticks);
+    }
+
+private:
+    struct Calibration {
+        double nsPerTick = 0;   // 0: no usable tsc, ticks() are nanoseconds
+    };
+
+    static const Calibration& calibration() {
+        static const Calibration c = calibrate();
+        return c;
+    }
+
+    // ~10ms busy spin once per process, the first call pays it
+    static Calibration calibrate() {
+        Calibration c;
+#ifdef CLOCK_HAS_TSC
+        unsigned eax, ebx, ecx, edx;
+        if (!__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) || !(edx & (1u << 8))) return c;
+        int64_t ns0 = Clock::steadyNanos();
+        uint64_t t0 = __rdtsc();
+        int64_t ns1;
+        do {
+            ns1 = Clock::steadyNanos();
+        } while (ns1 - ns0 < 10 * 1000 * 1000);
+        uint64_t t1 = __rdtsc();
+        if (t1 > t0) c.nsPerTick = static_cast<double>(ns1 - ns0) / static_cast<double>(t1 - t0);
+#endif
+        return c;
+    }
+};
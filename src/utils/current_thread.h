@@ -8,7 +8,7 @@ namespace CurrentThread
     // variable with inline prefix can be define in headers, just like inline functions
     inline thread_local int t_cachedTid = 0;    
 
-    void cacheTid(){
+    inline void cacheTid(){
         if(t_cachedTid == 0){
             t_cachedTid = static_cast<pid_t>(::syscall(SYS_gettid));
         }
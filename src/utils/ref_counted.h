@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstdint>
+#include <utility>
+
+/**
+ * non-atomic intrusive reference count (CRTP)
+ * only for objects confined to a single thread ( e.g. a connection and its loop ),
+ * Derived must provide `void destroy()` which is called when the count drops to zero
+ */
+template<typename Derived>
+class RefCounted {
+public:
+    void addRef() { ++refs_; }
+    void release() {
+        if (--refs_ == 0) static_cast<Derived*>(this)->destroy();
+    }
+    uint32_t refCount() const { return refs_; }
+
+protected:
+    RefCounted() = default;
+    ~RefCounted() = default;
+
+private:
+    uint32_t refs_ = 0;
+};
+
+// smart pointer over RefCounted, same shape as shared_ptr but no atomics, no control block
+template<typename T>
+class RefPtr {
+public:
+    RefPtr() = default;
+    RefPtr(std::nullptr_t) {}
+    explicit RefPtr(T *p) : ptr_(p) { if (ptr_) ptr_->addRef(); }
+    RefPtr(const RefPtr &other) : ptr_(other.ptr_) { if (ptr_) ptr_->addRef(); }
+    RefPtr(RefPtr &&other) noexcept : ptr_(other.ptr_) { other.ptr_ = nullptr; }
+    ~RefPtr() { if (ptr_) ptr_->release(); }
+
+    RefPtr& operator=(RefPtr other) noexcept {
+        std::swap(ptr_, other.ptr_);
+        return *this;
+    }
+
+    T* get() const { return ptr_; }
+    T* operator->() const { return ptr_; }
+    T& operator*() const { return *ptr_; }
+    explicit operator bool() const { return ptr_ != nullptr; }
+
+    void reset() { RefPtr().swap(*this); }
+    void swap(RefPtr &other) noexcept { std::swap(ptr_, other.ptr_); }
+
+    friend bool operator==(const RefPtr &a, const RefPtr &b) { return a.ptr_ == b.ptr_; }
+    friend bool operator!=(const RefPtr &a, const RefPtr &b) { return a.ptr_ != b.ptr_; }
+
+private:
+    T *ptr_ = nullptr;
+};
@@ -0,0 +1,153 @@
+#pragma once
+
+#include <cstring>
+#include <cstddef>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SIMD_SEARCH_X86 1
+#endif
+
+/**
+ * vectorized byte search for protocol parsing
+ * SSE2 is baseline on x86-64, AVX2 is picked at runtime when the cpu has it,
+ * other architectures fall back to memchr
+ * all functions return `end` when nothing is found
+ */
+namespace simd {
+
+namespace detail {
+
+    inline const char* findByteScalar(const char *begin, const char *end, char c) {
+        const void *p = std::memchr(begin, c, static_cast<size_t>(end - begin));
+        return p ? static_cast<const char*>(p) : end;
+    }
+
+    inline const char* findAnyOfScalar(const char *begin, const char *end, const char *set, size_t n) {
+        bool table[256] = {};
+        for (size_t i = 0; i < n; ++i) table[static_cast<unsigned char>(set[i])] = true;
+        for (const char *p = begin; p < end; ++p) {
+            if (table[static_cast<unsigned char>(*p)]) return p;
+        }
+        return end;
+    }
+
+#ifdef SIMD_SEARCH_X86
+    __attribute__((target("sse2")))
+    inline const char* findByteSSE2(const char *begin, const char *end, char c) {
+        const __m128i needle = _mm_set1_epi8(c);
+        const char *p = begin;
+        for (; p + 16 <= end; p += 16) {
+            __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+            int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, needle));
+            if (mask) return p + __builtin_ctz(static_cast<unsigned>(mask));
+        }
+        return findByteScalar(p, end, c);
+    }
+
+    __attribute__((target("avx2")))
+    inline const char* findByteAVX2(const char *begin, const char *end, char c) {
+        const __m256i needle = _mm256_set1_epi8(c);
+        const char *p = begin;
+        for (; p + 32 <= end; p += 32) {
+            __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+            unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, needle)));
+            if (mask) return p + __builtin_ctz(mask);
+        }
+        return findByteSSE2(p, end, c);
+    }
+
+    // one compare per set member, OR-ed together, up to 16 members
+    __attribute__((target("sse2")))
+    inline const char* findAnyOfSSE2(const char *begin, const char *end, const char *set, size_t n) {
+        __m128i needles[16];
+        for (size_t i = 0; i < n; ++i) needles[i] = _mm_set1_epi8(set[i]);
+        const char *p = begin;
+        for (; p + 16 <= end; p += 16) {
+            __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+            __m128i hit = _mm_setzero_si128();
+            for (size_t i = 0; i < n; ++i) hit = _mm_or_si128(hit, _mm_cmpeq_epi8(chunk, needles[i]));
+            int mask = _mm_movemask_epi8(hit);
+            if (mask) return p + __builtin_ctz(static_cast<unsigned>(mask));
+        }
+        return findAnyOfScalar(p, end, set, n);
+    }
+
+    __attribute__((target("avx2")))
+    inline const char* findAnyOfAVX2(const char *begin, const char *end, const char *set, size_t n) {
+        __m256i needles[16];
+        for (size_t i = 0; i < n; ++i) needles[i] = _mm256_set1_epi8(set[i]);
+        const char *p = begin;
+        for (; p + 32 <= end; p += 32) {
+            __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+            __m256i hit = _mm256_setzero_si256();
+            for (size_t i = 0; i < n; ++i) hit = _mm256_or_si256(hit, _mm256_cmpeq_epi8(chunk, needles[i]));
+            unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(hit));
+            if (mask) return p + __builtin_ctz(mask);
+        }
+        return findAnyOfSSE2(p, end, set, n);
+    }
+#endif
+
+    struct Dispatch {
+        const char* (*findByte)(const char*, const char*, char);
+        const char* (*findAnyOf)(const char*, const char*, const char*, size_t);
+    };
+
+    // resolved once per process
+    inline Dispatch resolve() {
+#ifdef SIMD_SEARCH_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) return { findByteAVX2, findAnyOfAVX2 };
+        return { findByteSSE2, findAnyOfSSE2 };
+#else
+        return { findByteScalar, findAnyOfScalar };
+#endif
+    }
+
+    inline const Dispatch& dispatch() {
+        // function-local, safe to use from other static initializers
+        static const Dispatch d = resolve();
+        return d;
+    }
+
+} // namespace detail
+
+inline const char* findByte(const char *begin, const char *end, char c) {
+    return detail::dispatch().findByte(begin, end, c);
+}
+
+// first byte that is any of set[0, n), n <= 16
+inline const char* findAnyOf(const char *begin, const char *end, const char *set, size_t n) {
+    if (n == 0) return end;
+    if (n == 1) return findByte(begin, end, set[0]);
+    if (n > 16) return detail::findAnyOfScalar(begin, end, set, n);
+    return detail::dispatch().findAnyOf(begin, end, set, n);
+}
+
+// first "\r\n", scans for '\r' and checks the next byte
+inline const char* findCRLF(const char *begin, const char *end) {
+    const char *p = begin;
+    while (p < end) {
+        p = findByte(p, end, '\r');
+        if (p + 1 >= end) return end;
+        if (p[1] == '\n') return p;
+        ++p;
+    }
+    return end;
+}
+
+// first "\r\n\r\n", end of an http header block
+inline const char* findDoubleCRLF(const char *begin, const char *end) {
+    const char *p = begin;
+    while (p < end) {
+        p = findCRLF(p, end);
+        if (p == end) return end;
+        if (end - p >= 4 && p[2] == '\r' && p[3] == '\n') return p;
+        if (end - p < 4) return end;
+        p += 2;
+    }
+    return end;
+}
+
+} // namespace simd
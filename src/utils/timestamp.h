@@ -5,6 +5,9 @@
 #include <chrono>
 #include <string>
 #include <array>
+#include <cstring>
+#include <cstdio>
+#include <ctime>
 
 using namespace std::chrono;
 class TimeStamp{
@@ -21,38 +24,94 @@ public:
         return TimeStamp(system_clock::now());
     }
     
+    // CLOCK_REALTIME_COARSE: tick-resolution ( ~1-4ms ), no vDSO clock read cost,
+    // for code paths that do not need microseconds
+    static TimeStamp nowCoarse(){
+        timespec ts;
+        ::clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+        return TimeStamp(static_cast<int64_t>(ts.tv_sec) * kmicroSecondsPerSecond + ts.tv_nsec / 1000);
+    }
+
     // like [2025/11/08 18:03:13.295632]
-    std::string toFormattedString(bool showMicroseconds = true) const{
-        auto tp = system_clock::time_point(
-            duration_cast<system_clock::duration>(microSecondsSinceEpoch_));
-        std::time_t time = system_clock::to_time_t(tp);
-        tm tm_time;
-        localtime_r(&time, &tm_time);   // thread-safe transfer
-        int64_t microseconds = microSecondsSinceEpoch_.count() % kmicroSecondsPerSecond;
-        std::array<char, 64> buf;   // buffer on stack with accessible size
-        if(showMicroseconds){
-            snprintf(buf.data(), buf.size(),  "%4d/%02d/%02d %02d:%02d:%02d.%06ld",
+    // writes into buf ( >= kFormattedSize bytes, nul-terminated ), returns the length
+    // localtime_r + snprintf only once per second per thread, otherwise copy and patch the µs
+    size_t formatTo(char *buf, bool showMicroseconds = true) const{
+        struct Cache { int64_t second = -1; char prefix[kSecondsPrefixLen + 1]; };
+        thread_local Cache cache;
+        int64_t sec = secondsSinceEpoch();
+        if(sec != cache.second){
+            std::time_t time = static_cast<std::time_t>(sec);
+            tm tm_time;
+            localtime_r(&time, &tm_time);   // thread-safe transfer
+            std::array<char, 64> tmp;   // roomy, the compiler cannot bound tm fields
+            snprintf(tmp.data(), tmp.size(), "%4d/%02d/%02d %02d:%02d:%02d",
                 tm_time.tm_year + 1900,
                 tm_time.tm_mon + 1,
                 tm_time.tm_mday,
                 tm_time.tm_hour,
                 tm_time.tm_min,
-                tm_time.tm_sec,
-                microseconds    
+                tm_time.tm_sec
             );
-        }else{
-            snprintf(buf.data(), buf.size(),  "%4d/%02d/%02d %02d:%02d:%02d",
-                tm_time.tm_year + 1900,
-                tm_time.tm_mon + 1,
+            std::memcpy(cache.prefix, tmp.data(), kSecondsPrefixLen);
+            cache.prefix[kSecondsPrefixLen] = '\0';
+            cache.second = sec;
+        }
+        std::memcpy(buf, cache.prefix, kSecondsPrefixLen);
+        if(!showMicroseconds){
+            buf[kSecondsPrefixLen] = '\0';
+            return kSecondsPrefixLen;
+        }
+        int64_t micro = microSecondsSinceEpoch_.count() % kmicroSecondsPerSecond;
+        char *p = buf + kSecondsPrefixLen;
+        *p++ = '.';
+        for(int i = 5; i >= 0; --i){
+            p[i] = static_cast<char>('0' + micro % 10);
+            micro /= 10;
+        }
+        p[6] = '\0';
+        return kSecondsPrefixLen + 7;
+    }
+
+    std::string toFormattedString(bool showMicroseconds = true) const{
+        std::array<char, kFormattedSize> buf;   // buffer on stack with accessible size
+        size_t n = formatTo(buf.data(), showMicroseconds);
+        return std::string(buf.data(), n);
+    }
+
+    // RFC 1123, like "Sun, 06 Nov 1994 08:49:37 GMT", for http Date headers
+    // cached per thread, recomputed once per second; buf >= kHttpDateSize bytes
+    size_t formatHttpDate(char *buf) const{
+        struct Cache { int64_t second = -1; char text[kHttpDateSize]; };
+        thread_local Cache cache;
+        int64_t sec = secondsSinceEpoch();
+        if(sec != cache.second){
+            static const char* days[] = {"Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat"};
+            static const char* months[] = {"Jan", "Feb", "Mar", "Apr", "May", "Jun",
+                                           "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"};
+            std::time_t time = static_cast<std::time_t>(sec);
+            tm tm_time;
+            gmtime_r(&time, &tm_time);      // no timezone lock
+            std::array<char, 64> tmp;
+            snprintf(tmp.data(), tmp.size(), "%s, %02d %s %4d %02d:%02d:%02d GMT",
+                days[tm_time.tm_wday],
                 tm_time.tm_mday,
+                months[tm_time.tm_mon],
+                tm_time.tm_year + 1900,
                 tm_time.tm_hour,
                 tm_time.tm_min,
                 tm_time.tm_sec
             );
+            std::memcpy(cache.text, tmp.data(), kHttpDateSize - 1);
+            cache.text[kHttpDateSize - 1] = '\0';
+            cache.second = sec;
         }
-        return buf.data();
+        std::memcpy(buf, cache.text, kHttpDateSize);
+        return kHttpDateSize - 1;
     }
 
+    static constexpr size_t kFormattedSize = 32;
+    static constexpr size_t kHttpDateSize = 30;    // 29 chars + nul
+
     int64_t microSecondsSinceEpoch() const { return microSecondsSinceEpoch_.count(); }
 
     int64_t secondsSinceEpoch() const { 
@@ -69,6 +128,7 @@ public:
     private:
     microseconds microSecondsSinceEpoch_;
     static const int kmicroSecondsPerSecond = 1000000;
+    static constexpr size_t kSecondsPrefixLen = 19;     // "YYYY/MM/DD HH:MM:SS"
 
 };
 
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstdint>
+#include <algorithm>
+#include <limits>
+
+/**
+ * token bucket: refills at rate tokens per second up to burst
+ * not thread-safe, meant to live inside something owned by one loop,
+ * time is passed in ( steady micros, usually the loop's cached clock )
+ * rate == 0 means unlimited
+ */
+class TokenBucket {
+public:
+    TokenBucket() = default;
+    TokenBucket(double ratePerSecond, double burst, int64_t nowMicros) {
+        reset(ratePerSecond, burst, nowMicros);
+    }
+
+    // burst <= 0 allows one second worth of tokens, starts full
+    void reset(double ratePerSecond, double burst, int64_t nowMicros) {
+        rate_ = ratePerSecond / 1e6;
+        burst_ = burst > 0 ? burst : ratePerSecond;
+        tokens_ = burst_;
+        last_ = nowMicros;
+    }
+
+    bool limited() const { return rate_ > 0; }
+
+    double available(int64_t nowMicros) {
+        refill(nowMicros);
+        return limited() ? tokens_ : std::numeric_limits<double>::infinity();
+    }
+
+    bool tryTake(double n, int64_t nowMicros) {
+        if (!limited()) return true;
+        refill(nowMicros);
+        if (tokens_ < n) return false;
+        tokens_ -= n;
+        return true;
+    }
+
+    // unconditional, the balance may go negative ( e.g. a read whose size is known afterwards )
+    void take(double n, int64_t nowMicros) {
+        if (!limited()) return;
+        refill(nowMicros);
+        tokens_ -= n;
+    }
+
+    // how long until n tokens are there, 0 if they already are
+    int64_t microsUntil(double n, int64_t nowMicros) {
+        if (!limited()) return 0;
+        refill(nowMicros);
+        n = std::min(n, burst_);
+        return tokens_ >= n ? 0 : static_cast<int64_t>((n - tokens_) / rate_) + 1;
+    }
+
+private:
+    void refill(int64_t nowMicros) {
+        if (nowMicros > last_) {
+            tokens_ = std::min(burst_, tokens_ + (nowMicros - last_) * rate_);
+            last_ = nowMicros;
+        }
+    }
+
+    double rate_ = 0;       // tokens per microsecond
+    double burst_ = 0;
+    double tokens_ = 0;
+    int64_t last_ = 0;
+};